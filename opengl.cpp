@@ -38,7 +38,10 @@ int main(int argc, char* args[]) {
                         // }
                     }
                 }
+                gProfiler.begin_frame();
+                gProfiler.begin_zone("update");
                 update();
+                gProfiler.end_zone();
                 render();
 
                 // SDL_SetRenderDrawColor(renderer, BLACK.r, BLACK.g, BLACK.b, BLACK.a); //black
@@ -58,7 +61,10 @@ int main(int argc, char* args[]) {
                 //     t_fps.render(SCREEN_WIDTH-t_fps.get_width(), 0);
                 // }
 
+                gProfiler.begin_zone("swap");
                 SDL_GL_SwapWindow(window);
+                gProfiler.end_zone();
+                gProfiler.end_frame();
                 // frame_count++;
             }
             SDL_StopTextInput();
@@ -49,6 +49,54 @@ void handleKeys(char key, int x, int y);
 
 Font gFont;
 
+//sprite stress test, 'b' switches between the batch and one draw call per sprite
+const int STRESS_SPRITES = 2000;
+SpriteSheet gArrows;
+SpriteBatch gBatch;
+bool gBatching = true;
+//'s' draws the sprites and the counters through GLSL 3.3 programs instead, when the context has them. Unbatched
+//sprites and text go through gTexturedProgram one draw at a time
+ShaderSpriteBatch gShaderBatch;
+TexturedPolygonProgram2D gTexturedProgram;
+bool gShadersAvailable = false;
+bool gShaders = false;
+//distance field text from cc.ttf, every size below draws from one atlas
+SDFFont gSDFFont;
+bool gSDFLoaded = false;
+//obj mesh uploaded once and drawn with one glDrawElements, when the file is there
+Model* gModel = nullptr;
+bool gModelLoaded = false;
+
+//'v' cycles the viewport modes. Every mode but full records the sprites and atlas strip once and replays the
+//list into each of its viewports
+ViewPortMode gViewportMode = VIEWPORT_MODE_FULL;
+CommandList gSceneList;
+
+//the small game sheets share one atlas page, so the strip along the bottom is a single bind
+const char* ATLAS_IMAGES[] = {"res/mini_opengl.png", "res/tictactoe.png", "res/rps.png", "res/bricks.png",
+                              "res/leaper_tiles.png", "res/pacman.png", "res/asteroids.png", "res/tetris.png"};
+TextureAtlas gAtlas;
+
+//cpu and gpu time per zone, 'p' shows them in place of the counters and 'd' writes the averages to PROFILE_PATH
+Profiler gProfiler;
+bool gProfileOverlay = false;
+const char* PROFILE_PATH = "profile.txt";
+
+//the counters and the SDF text sit in framebuffer layers, redrawn only when what they show changes
+RenderLayer gCountersLayer;
+RenderLayer gSDFLayer;
+bool gLayersAvailable = false;
+std::string gCountersText;
+//the counters include the cost of redrawing themselves, so a redraw always changes the next frame's numbers. They
+//are redrawn at once when the mode changes and again next frame with that mode's numbers, otherwise at most every
+//COUNTERS_REFRESH_FRAMES frames
+std::string gCountersMode;
+const int COUNTERS_REFRESH_FRAMES = 30;
+int gCountersAge = 0;
+
+//a dot painted into the arrow sheet each frame, only the 4x4 texels it covers are uploaded
+int gPaintStep = 0;
+
 bool init() {
     bool success = true;
 
@@ -132,7 +180,7 @@ bool initGL() {
     //Set blending
     glEnable(GL_BLEND);
     glDisable(GL_DEPTH_TEST); //useful in 3d, not 2d
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     //Check for errors
     error = glGetError();
@@ -155,20 +203,97 @@ bool load() {
     //     success = false;
     // }
 
-    // model = new Model("res/african_head.obj");
+    gModel = new Model("res/african_head.obj");
+    if (gModel->num_faces() > 0) {
+        if (gModel->generate_mesh()) {
+            gModelLoaded = true;
+        } else {
+            printf("Unable to upload the model mesh!\n");
+        }
+    }
 
     if (!gFont.load_bitmap("res/lazy_font.png")) {
         printf("Unable to load bitmap font!\n");
         success = false;
     }
 
+    if (!gArrows.load_texture_from_file("res/arrows.png")) {
+        printf("Unable to load arrow sprites!\n");
+        success = false;
+    } else {
+        //2x2 grid of 128x128 arrows
+        for (int i = 0; i < 4; i++) {
+            FRect clip = {128.f * (i % 2), 128.f * (i / 2), 128.f, 128.f};
+            gArrows.add_sprite_clip(clip);
+        }
+        if (!gArrows.generate_data_buffer()) {
+            printf("Unable to create arrow sprite buffers!\n");
+            success = false;
+        }
+    }
+
+    std::vector<std::string> atlas_images(ATLAS_IMAGES, ATLAS_IMAGES + sizeof(ATLAS_IMAGES) / sizeof(ATLAS_IMAGES[0]));
+    if (!gAtlas.build(atlas_images, 1024)) {
+        printf("Unable to build the texture atlas!\n");
+        success = false;
+    }
+
+    print_texture_memory();
+
+    gProfiler.init();
+
+    gLayersAvailable = gCountersLayer.init("counters", SCREEN_WIDTH, SCREEN_HEIGHT / 2) &&
+                       gSDFLayer.init("sdf text", SCREEN_WIDTH, SCREEN_HEIGHT);
+
+    if (!gBatch.init(STRESS_SPRITES)) {
+        printf("Unable to create the sprite batch!\n");
+        success = false;
+    }
+
+    if (!gSceneList.init(STRESS_SPRITES + 16)) {
+        printf("Unable to create the scene command list!\n");
+        success = false;
+    }
+
+    if (GLEW_VERSION_3_3) {
+        if (gShaderBatch.init(STRESS_SPRITES) && gTexturedProgram.load_program()) {
+            gShaderBatch.begin();
+            gShaderBatch.set_projection(ortho_matrix(0.f, SCREEN_WIDTH, SCREEN_HEIGHT, 0.f, 1.f, -1.f));
+            gShaderBatch.end();
+            gShadersAvailable = true;
+        } else {
+            printf("Unable to create the shader sprite batch!\n");
+        }
+        if (gSDFFont.load_font("res/cc.ttf")) {
+            gSDFFont.set_projection(ortho_matrix(0.f, SCREEN_WIDTH, SCREEN_HEIGHT, 0.f, 1.f, -1.f));
+            gSDFLoaded = true;
+        } else {
+            printf("Unable to load the SDF font!\n");
+        }
+    }
+
     return success;
 }
 
 bool close() {
     // t_fps.free();
     // image.free();
-    // if (model != nullptr) { delete model; }
+    if (gModel != nullptr) { delete gModel; gModel = nullptr; }
+    gCountersLayer.print_stats();
+    gSDFLayer.print_stats();
+    gCountersLayer.free_layer();
+    gSDFLayer.free_layer();
+    gSceneList.free_batch();
+    gShaderBatch.free_batch();
+    gBatch.free_batch();
+    gSDFFont.free_font();
+    gFont.free_font();
+    gAtlas.free_atlas();
+    gArrows.free_texture();
+    gProfiler.free_profiler();
+    gTexturedProgram.free_program();
+    free_vertex_formats();
+    free_upload_ring();
     if (font != nullptr) { TTF_CloseFont(font); font = nullptr; }
     if (window != nullptr) { SDL_DestroyWindow(window); window = nullptr; }
     TTF_Quit();
@@ -177,17 +302,225 @@ bool close() {
 }
 
 void update() {
+    if (gArrows.lock()) {
+        GLuint x = (gPaintStep * 4) % (gArrows.get_image_width() - 4);
+        GLuint y = (gPaintStep * 12) % (gArrows.get_image_height() - 4);
+        for (GLuint py = y; py < y + 4; py++) {
+            for (GLuint px = x; px < x + 4; px++) {
+                gArrows.set_pixel(px, py, 0xFF0000FF);
+            }
+        }
+        gArrows.unlock();
+        gPaintStep++;
+    }
+}
+
+void render_sdf_text() {
+    GLfloat y = 250.f;
+    for (GLfloat size = 12.f; size <= 96.f; size *= 2.f) {
+        gSDFFont.render_text(260.f, y, "SDF text", size, 0.f, 0.4f, 1.f);
+        y += gSDFFont.get_line_height(size);
+    }
+}
+
+//the recorded scene into every viewport of the mode, then back to the whole window
+void render_viewports() {
+    Matrix4 projection = ortho_matrix(0.f, SCREEN_WIDTH, SCREEN_HEIGHT, 0.f, 1.f, -1.f);
+    glLoadIdentity();
+    switch (gViewportMode) {
+        case VIEWPORT_MODE_HALF_CENTER:
+            gSceneList.replay(SCREEN_WIDTH / 4, SCREEN_HEIGHT / 4, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, projection);
+            break;
+        case VIEWPORT_MODE_HALF_TOP:
+            gSceneList.replay(SCREEN_WIDTH / 4, SCREEN_HEIGHT / 2, SCREEN_WIDTH / 2, SCREEN_HEIGHT / 2, projection);
+            break;
+        case VIEWPORT_MODE_QUAD:
+            for (int i = 0; i < 4; i++) {
+                gSceneList.replay((i % 2) * SCREEN_WIDTH / 2, (i / 2) * SCREEN_HEIGHT / 2, SCREEN_WIDTH / 2,
+                                  SCREEN_HEIGHT / 2, projection);
+            }
+            break;
+        case VIEWPORT_MODE_RADAR:
+            //the whole scene, then a quarter size copy of it in the top right corner
+            gSceneList.replay(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, projection);
+            gSceneList.replay(SCREEN_WIDTH * 3 / 4, SCREEN_HEIGHT * 3 / 4, SCREEN_WIDTH / 4, SCREEN_HEIGHT / 4, projection);
+            break;
+        default:
+            gSceneList.replay(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, projection);
+            break;
+    }
+    glViewport(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+}
+
+//red text at the top left, through gTexturedProgram when 's' is on
+void render_counters(const std::string& text, const Matrix4& projection) {
+    if (!gShaders) {
+        gFont.render_text(0.f, 0.f, text);
+        return;
+    }
+    gTexturedProgram.bind();
+    gTexturedProgram.set_projection(projection);
+    gTexturedProgram.set_modelview(identity_matrix());
+    gTexturedProgram.set_color(1.f, 0.f, 0.f);
+    gFont.render_text(gTexturedProgram, 0.f, 0.f, text);
+    gTexturedProgram.unbind();
 }
 
 void render() {
+    //counters of the last frame, for the overlay
+    RenderStats last_frame = render_stats;
+    reset_render_stats();
+
     //Clear color buffer
     glClear(GL_COLOR_BUFFER_BIT);
     glLoadIdentity();
 
+    glColor3f(1.f, 1.f, 1.f);
+    gProfiler.begin_zone("sprites");
+    bool recording = gViewportMode != VIEWPORT_MODE_FULL;
+    SpriteBatch& batch = recording ? gSceneList : gShaders ? gShaderBatch : gBatch;
+    if (gBatching || recording) {
+        batch.begin();
+        for (int i = 0; i < STRESS_SPRITES; i++) {
+            batch.draw_sprite(gArrows, i % 4, (i * 37) % SCREEN_WIDTH, (i * 53) % SCREEN_HEIGHT);
+        }
+    } else if (gShaders) {
+        gTexturedProgram.bind();
+        gTexturedProgram.set_projection(ortho_matrix(0.f, SCREEN_WIDTH, SCREEN_HEIGHT, 0.f, 1.f, -1.f));
+        gTexturedProgram.set_color(1.f, 1.f, 1.f);
+        for (int i = 0; i < STRESS_SPRITES; i++) {
+            gTexturedProgram.set_modelview(translation_matrix((i * 37) % SCREEN_WIDTH, (i * 53) % SCREEN_HEIGHT, 0.f));
+            gArrows.render_sprite(gTexturedProgram, i % 4);
+        }
+        gTexturedProgram.set_modelview(identity_matrix());
+        gTexturedProgram.unbind();
+        batch.begin();
+    } else {
+        for (int i = 0; i < STRESS_SPRITES; i++) {
+            glLoadIdentity();
+            glTranslatef((i * 37) % SCREEN_WIDTH, (i * 53) % SCREEN_HEIGHT, 0.f);
+            gArrows.render_sprite(i % 4);
+        }
+        glLoadIdentity();
+        batch.begin();
+    }
+    gProfiler.end_zone();
+
+    gProfiler.begin_zone("atlas");
+    GLfloat x = 0.f;
+    GLfloat y = SCREEN_HEIGHT;
+    for (size_t i = 0; i < sizeof(ATLAS_IMAGES) / sizeof(ATLAS_IMAGES[0]); i++) {
+        AtlasEntry* entry = gAtlas.find(ATLAS_IMAGES[i]);
+        if (entry == nullptr) continue;
+        if (x + entry->clip.w > SCREEN_WIDTH) {
+            x = 0.f;
+            y -= 160.f;
+        }
+        batch.draw_texture(gAtlas.get_page(entry->page), x, y - entry->clip.h, &entry->clip);
+        x += entry->clip.w;
+    }
+    gProfiler.end_zone();
+    gProfiler.begin_zone("flush");
+    batch.end();
+    gProfiler.end_zone();
+
+    if (recording) {
+        ProfileScope zone(gProfiler, "replay");
+        render_viewports();
+    }
+
+    if (gModelLoaded) {
+        ProfileScope zone(gProfiler, "model");
+        //deep enough for the model scaled evenly, so the normals keep their direction
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        glOrtho(0.0, SCREEN_WIDTH, SCREEN_HEIGHT, 0.0, 100.0, -100.0);
+        glMatrixMode(GL_MODELVIEW);
+        //y flipped into screen space turns the winding around, so the back faces are the front ones here
+        glLoadIdentity();
+        glTranslatef(SCREEN_WIDTH - 100.f, 100.f, 0.f);
+        glScalef(80.f, -80.f, 80.f);
+        glDisable(GL_TEXTURE_2D);
+        glEnable(GL_LIGHTING);
+        glEnable(GL_LIGHT0);
+        glEnable(GL_COLOR_MATERIAL);
+        glEnable(GL_NORMALIZE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glColor3f(0.8f, 0.8f, 0.8f);
+        gModel->render();
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_NORMALIZE);
+        glDisable(GL_COLOR_MATERIAL);
+        glDisable(GL_LIGHTING);
+        glEnable(GL_TEXTURE_2D);
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+    }
 
+    gProfiler.begin_zone("text");
+    glLoadIdentity();
     glColor3f(1.f, 0.f, 0.f);
-    gFont.render_text(0.f, 0.f, "The quick brown fox jumps\nover the lazy dog");
+    std::stringstream mode;
+    mode << (gBatching ? "batched" : "unbatched") << (gShaders ? " shader" : "") << " sprites: " << STRESS_SPRITES;
+    std::stringstream stats;
+    stats << mode.str()
+          << "\ndraw calls: " << last_frame.draw_calls << "\nvertices: " << last_frame.vertices
+          << "\nuploads: " << last_frame.texture_uploads << " (" << last_frame.upload_bytes << " bytes)"
+          << "\nstate calls: " << last_frame.state_calls << ", elided: " << last_frame.elided_state_calls;
+    if (gProfileOverlay) {
+        gProfiler.render_overlay(gFont, 0.f, 0.f);
+    } else if (!gLayersAvailable) {
+        render_counters(stats.str(), ortho_matrix(0.f, SCREEN_WIDTH, SCREEN_HEIGHT, 0.f, 1.f, -1.f));
+    } else {
+        gCountersAge++;
+        if (mode.str() != gCountersMode) {
+            gCountersMode = mode.str();
+            gCountersText = stats.str();
+            gCountersAge = COUNTERS_REFRESH_FRAMES - 1;
+            gCountersLayer.mark_dirty();
+        } else if (gCountersAge >= COUNTERS_REFRESH_FRAMES && stats.str() != gCountersText) {
+            gCountersText = stats.str();
+            gCountersAge = 0;
+            gCountersLayer.mark_dirty();
+        }
+        if (gCountersLayer.begin_update()) {
+            render_counters(gCountersText, gCountersLayer.get_projection());
+            gCountersLayer.end_update();
+        }
+        gCountersLayer.render(0.f, 0.f);
+    }
+    gProfiler.end_zone();
+
+    if (gSDFLoaded) {
+        ProfileScope zone(gProfiler, "sdf text");
+        if (!gLayersAvailable) {
+            render_sdf_text();
+        } else {
+            if (gSDFLayer.begin_update()) {
+                gSDFFont.set_projection(gSDFLayer.get_projection());
+                render_sdf_text();
+                gSDFFont.set_projection(ortho_matrix(0.f, SCREEN_WIDTH, SCREEN_HEIGHT, 0.f, 1.f, -1.f));
+                gSDFLayer.end_update();
+            }
+            glLoadIdentity();
+            gSDFLayer.render(0.f, 0.f);
+        }
+    }
 }
 
 void handleKeys(char key, int x, int y) {
+    if (key == 'b') {
+        gBatching = !gBatching;
+    } else if (key == 's' && gShadersAvailable) {
+        gShaders = !gShaders;
+    } else if (key == 'p') {
+        gProfileOverlay = !gProfileOverlay;
+    } else if (key == 'd') {
+        gProfiler.dump(PROFILE_PATH);
+    } else if (key == 'v') {
+        gViewportMode = (ViewPortMode)((gViewportMode + 1) % (VIEWPORT_MODE_RADAR + 1));
+    }
 }
@@ -1,9 +1,18 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
 #include <cassert>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <new>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <SDL.h>
 #define STB_IMAGE_IMPLEMENTATION
@@ -15,6 +24,7 @@ const uint32_t SCREEN_HEIGHT = 512;
 SDL_Window* window = NULL;
 SDL_Renderer* renderer = NULL;
 SDL_Texture *framebuffer_texture = NULL;
+SDL_Texture *view_texture = NULL;
 
 void logSDLError(std::ostream &os, const std::string &msg) {
     os << msg << " SDL Error: " << SDL_GetError() << std::endl;
@@ -51,6 +61,7 @@ bool load() {
 
 bool close() {
     if (framebuffer_texture != nullptr) {SDL_DestroyTexture(framebuffer_texture); framebuffer_texture = NULL; }
+    if (view_texture != nullptr) {SDL_DestroyTexture(view_texture); view_texture = NULL; }
     if (renderer != nullptr) { SDL_DestroyRenderer(renderer); renderer = NULL; }
     if (window != nullptr) { SDL_DestroyWindow(window); window = NULL; }
     SDL_Quit();
@@ -59,6 +70,50 @@ bool close() {
 
 // Initial code from @ssloy on github
 
+// every operator new bumps this, so the main loop can check a steady-state frame doesn't touch the heap
+size_t heap_allocations = 0;
+
+void* operator new(size_t size) {
+    heap_allocations++;
+    void* p = malloc(size ? size : 1);
+    if (p == nullptr) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// per-frame scratch memory: one block reserved up front, bumped during a frame and reset at the top of the next.
+// A request that doesn't fit gets null instead of memory past the end
+class FrameArena {
+public:
+    FrameArena(size_t capacity) : buffer(capacity), offset(0), high_water(0) {}
+    template <class T> T* alloc(size_t count) {
+        size_t start = (offset + alignof(T) - 1) & ~(alignof(T) - 1);
+        if (start + count * sizeof(T) > buffer.size()) return nullptr;
+        offset = start + count * sizeof(T);
+        if (offset > high_water) high_water = offset;
+        return reinterpret_cast<T*>(buffer.data() + start);
+    }
+    size_t mark() { return offset; }
+    void release(size_t m) { offset = m; }
+    // grows the block when a frame will need more than it has, only between frames since it moves the memory
+    void reset(size_t frame_bytes) {
+        offset = 0;
+        if (frame_bytes > buffer.size()) buffer.resize(frame_bytes);
+    }
+    size_t get_high_water() { return high_water; }
+private:
+    std::vector<uint8_t> buffer;
+    size_t offset;
+    size_t high_water;
+};
+
 uint32_t pack_color(const uint8_t r, const uint8_t g, const uint8_t b, const uint8_t a=255) {
     return (a << 24u) + (b << 16u) + (g << 8u) + r;
 }
@@ -99,16 +154,193 @@ bool load_texture(const std::string filename, std::vector<uint32_t> &texture, si
     return true;
 }
 
-void draw_rectangle(std::vector<uint32_t> &frame, const size_t i_w, const size_t i_h, const uint32_t color, const size_t x, const size_t y, const size_t w, const size_t h) {
-    assert(frame.size() == i_w*i_h);
+// the packed texture strip halved level by level, so small wall columns read small textures
+const size_t MAX_MIP_LEVELS = 16;
+
+struct MipChain {
+    size_t levels;
+    size_t offsets[MAX_MIP_LEVELS]; // start of each level in texels, level 0 is the strip as loaded
+    std::vector<uint32_t> texels;
+};
+
+// 2x2 box filter per channel, the squares halve in place so a texel never blends with its neighbouring texture
+void build_mip_chain(const std::vector<uint32_t> &texture, const size_t text_size, const size_t text_cnt, MipChain &mips) {
+    mips.texels = texture;
+    mips.offsets[0] = 0;
+    mips.levels = 1;
+    size_t size = text_size;
+    while (size > 1 && size % 2 == 0 && mips.levels < MAX_MIP_LEVELS) {
+        const size_t src_w = size * text_cnt;
+        const size_t dst_w = src_w / 2;
+        const size_t src_offset = mips.offsets[mips.levels - 1];
+        const size_t dst_offset = mips.texels.size();
+        mips.texels.resize(dst_offset + dst_w * (size / 2));
+        for (size_t j = 0; j < size / 2; j++) {
+            for (size_t i = 0; i < dst_w; i++) {
+                const uint32_t *src = &mips.texels[src_offset + 2*i + 2*j*src_w];
+                uint32_t texel = 0;
+                for (int shift = 0; shift < 32; shift += 8) {
+                    uint32_t sum = ((src[0] >> shift) & 0xFFu) + ((src[1] >> shift) & 0xFFu)
+                                 + ((src[src_w] >> shift) & 0xFFu) + ((src[src_w + 1] >> shift) & 0xFFu);
+                    texel |= ((sum + 2) / 4) << shift;
+                }
+                mips.texels[dst_offset + i + j*dst_w] = texel;
+            }
+        }
+        mips.offsets[mips.levels++] = dst_offset;
+        size /= 2;
+    }
+}
+
+// the smallest level that still has a texel for every pixel of the column
+inline size_t mip_level(const MipChain &mips, const size_t text_size, const size_t column_height) {
+    size_t level = 0;
+    while (level + 1 < mips.levels && (text_size >> (level + 1)) >= column_height) level++;
+    return level;
+}
+
+/* INDEXED COLOR */
+// optional 8 bit pipeline: the mip chain quantized to palette indices, distance shading through a colormap,
+// and one palette expansion at the end of the frame
+const size_t PALETTE_SIZE = 256;
+const size_t LIGHT_LEVELS = 32;
+const float LIGHT_FALLOFF = 1.5;  // light levels lost per map cell of distance
+const size_t MIN_LIGHT_LEVEL = 8; // far walls fade to this instead of black
+
+struct IndexedTextures {
+    uint32_t palette[PALETTE_SIZE];            // entry 0 is the view's clear color
+    std::vector<uint8_t> texels;               // same layout and offsets as the MipChain
+    uint8_t colormap[LIGHT_LEVELS][PALETTE_SIZE]; // each palette entry darkened to a light level, LIGHT_LEVELS-1 is full bright
+};
+
+// colors are bucketed at 5 bits per channel for the histogram and the nearest entry lookup
+inline size_t color_bucket(const uint32_t color) {
+    return ((color >> 3) & 0x1Fu) | (((color >> 11) & 0x1Fu) << 5) | (((color >> 19) & 0x1Fu) << 10);
+}
+
+uint8_t nearest_palette_index(const uint32_t *palette, const int r, const int g, const int b) {
+    uint8_t best = 0;
+    int best_distance = INT32_MAX;
+    for (size_t p = 0; p < PALETTE_SIZE; p++) {
+        int dr = r - int(palette[p] & 0xFFu);
+        int dg = g - int((palette[p] >> 8) & 0xFFu);
+        int db = b - int((palette[p] >> 16) & 0xFFu);
+        int distance = dr*dr + dg*dg + db*db;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best = p;
+        }
+    }
+    return best;
+}
+
+// popularity quantizer: the 255 busiest buckets (averaged) become the palette
+void build_indexed_textures(const MipChain &mips, const uint32_t clear_color, IndexedTextures &indexed) {
+    const size_t BUCKETS = 1 << 15;
+    std::vector<uint32_t> counts(BUCKETS, 0);
+    std::vector<uint64_t> sums(BUCKETS * 3, 0);
+    for (size_t t = 0; t < mips.texels.size(); t++) {
+        uint32_t color = mips.texels[t];
+        size_t bucket = color_bucket(color);
+        counts[bucket]++;
+        sums[bucket*3 + 0] += color & 0xFFu;
+        sums[bucket*3 + 1] += (color >> 8) & 0xFFu;
+        sums[bucket*3 + 2] += (color >> 16) & 0xFFu;
+    }
+    std::vector<uint32_t> order(BUCKETS);
+    for (size_t b = 0; b < BUCKETS; b++) order[b] = b;
+    std::partial_sort(order.begin(), order.begin() + PALETTE_SIZE - 1, order.end(), [&counts](uint32_t a, uint32_t b) { return counts[a] > counts[b]; });
+    indexed.palette[0] = clear_color;
+    for (size_t p = 1; p < PALETTE_SIZE; p++) {
+        uint32_t bucket = order[p - 1];
+        uint32_t n = std::max<uint32_t>(counts[bucket], 1);
+        indexed.palette[p] = pack_color(sums[bucket*3] / n, sums[bucket*3 + 1] / n, sums[bucket*3 + 2] / n);
+    }
+
+    std::vector<int16_t> lookup(BUCKETS, -1); // nearest entry per bucket, filled on first use
+    indexed.texels.resize(mips.texels.size());
+    for (size_t t = 0; t < mips.texels.size(); t++) {
+        uint32_t color = mips.texels[t];
+        size_t bucket = color_bucket(color);
+        if (lookup[bucket] < 0) lookup[bucket] = nearest_palette_index(indexed.palette, color & 0xFFu, (color >> 8) & 0xFFu, (color >> 16) & 0xFFu);
+        indexed.texels[t] = lookup[bucket];
+    }
+
+    for (size_t l = 0; l < LIGHT_LEVELS; l++) {
+        float light = float(l) / (LIGHT_LEVELS - 1);
+        for (size_t p = 0; p < PALETTE_SIZE; p++) {
+            uint32_t color = indexed.palette[p];
+            indexed.colormap[l][p] = nearest_palette_index(indexed.palette, (color & 0xFFu) * light, ((color >> 8) & 0xFFu) * light, ((color >> 16) & 0xFFu) * light);
+        }
+    }
+}
+
+inline size_t light_level(const float distance) {
+    float lost = std::min(distance * LIGHT_FALLOFF, float(LIGHT_LEVELS - 1 - MIN_LIGHT_LEVEL));
+    return LIGHT_LEVELS - 1 - size_t(lost);
+}
+
+// a 32 bit image with its own row pitch, either one of our buffers or texture memory handed out by SDL_LockTexture
+struct PixelTarget {
+    uint32_t *pixels;
+    size_t w, h;
+    size_t pitch; // in pixels, at least w
+};
+
+inline PixelTarget pixel_target(std::vector<uint32_t> &buffer, const size_t w, const size_t h) {
+    assert(buffer.size() >= w*h);
+    PixelTarget target = {buffer.data(), w, h, w};
+    return target;
+}
+
+// view_indexed is tightly packed, target.w bytes per row
+void expand_palette(PixelTarget &target, const uint8_t *view_indexed, const uint32_t *palette) {
+    for (size_t j = 0; j < target.h; j++) {
+        uint32_t *row = target.pixels + j*target.pitch;
+        const uint8_t *indices = view_indexed + j*target.w;
+        for (size_t i = 0; i < target.w; i++) row[i] = palette[indices[i]];
+    }
+}
+
+void draw_rectangle(PixelTarget &target, const uint32_t color, const size_t x, const size_t y, const size_t w, const size_t h) {
     for (size_t i = x; i < x + w; i++) {
         for (size_t j = y; j < y + h; j++) {
-            assert(i<i_w && j<i_h);
-            frame[i+j*i_w] = color;
+            assert(i<target.w && j<target.h);
+            target.pixels[i+j*target.pitch] = color;
         }
     }
 }
 
+void clear_framebuffer(uint32_t *pixels, const size_t count, const uint32_t color) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // walk up to a 16 byte boundary, then use non-temporal stores so the clear doesn't push the textures out of cache
+    for (; i < count && (reinterpret_cast<uintptr_t>(pixels + i) & 15u); i++) pixels[i] = color;
+    const __m128i color4 = _mm_set1_epi32(color);
+    for (; i + 4 <= count; i += 4) _mm_stream_si128(reinterpret_cast<__m128i *>(pixels + i), color4);
+    _mm_sfence();
+#endif
+    for (; i < count; i++) pixels[i] = color;
+}
+
+void clear_target(PixelTarget &target, const uint32_t color) {
+    if (target.pitch == target.w) {
+        clear_framebuffer(target.pixels, target.w*target.h, color);
+        return;
+    }
+    for (size_t j = 0; j < target.h; j++) clear_framebuffer(target.pixels + j*target.pitch, target.w, color);
+}
+
+// same size images, row by row when either side is padded
+void copy_target(PixelTarget &dst, const PixelTarget &src) {
+    assert(dst.w == src.w && dst.h == src.h);
+    if (dst.pitch == dst.w && src.pitch == src.w) {
+        memcpy(dst.pixels, src.pixels, dst.w*dst.h*sizeof(uint32_t));
+        return;
+    }
+    for (size_t j = 0; j < dst.h; j++) memcpy(dst.pixels + j*dst.pitch, src.pixels + j*src.pitch, dst.w*sizeof(uint32_t));
+}
+
 const uint32_t white = pack_color(255, 255, 255);
 const uint32_t black = pack_color(0, 0, 0);
 const uint32_t gray = pack_color(160, 160, 160);
@@ -119,75 +351,1065 @@ struct Sprite {
     size_t texture_id;
 };
 
-void drawSprites(const size_t win_w, const size_t win_h, std::vector<uint32_t> &framebuffer, const std::vector<Sprite> &sprites, const size_t map_w, const size_t map_h) {
+struct PointLight {
+    float x, y;
+    float intensity; // added brightness at the light, 1 lifts a surface from black to full bright
+    float radius;    // no light reaches past this
+};
+
+/* MAP STORAGE */
+// the grid is kept as 8x8 chunks: a 64 bit occupancy mask per chunk, plus 4 bit texture ids only for chunks that have walls
+const int CHUNK_SHIFT = 3;
+const int CHUNK_SIZE = 1 << CHUNK_SHIFT;
+const size_t CHUNK_TEXTURE_BYTES = CHUNK_SIZE*CHUNK_SIZE / 2;
+const uint32_t EMPTY_CHUNK = UINT32_MAX;
+const size_t MAX_MAP_TEXTURES = 16;
+
+struct GridMap {
+    size_t w, h; // in cells
+    size_t chunks_w, chunks_h;
+    std::vector<uint64_t> occupancy;      // per chunk, bit (x&7) + (y&7)*8 is set for walls
+    std::vector<uint32_t> texture_blocks; // per chunk, offset of its texture ids in textures, or EMPTY_CHUNK
+    std::vector<uint8_t> textures;        // two texture ids per byte
+    std::vector<uint8_t> distance;        // per cell in chunk order, Chebyshev distance to the nearest wall (0 on walls), saturating at MAX_SKIP_DISTANCE
+    uint32_t revision;                    // bumped on every edit, so cached views of the map know when to rebuild
+    std::vector<uint8_t> distance_scratch; // window transform of the last edit, kept so edits don't allocate
+};
+
+inline size_t chunk_index(const GridMap &map, const int x, const int y) {
+    return (x >> CHUNK_SHIFT) + (y >> CHUNK_SHIFT) * map.chunks_w;
+}
+
+inline int cell_bit(const int x, const int y) {
+    return (x & (CHUNK_SIZE-1)) + ((y & (CHUNK_SIZE-1)) << CHUNK_SHIFT);
+}
+
+// a chunk's 64 distances share one cache line, a ray walking through it touches just that line
+inline size_t distance_index(const GridMap &map, const int x, const int y) {
+    return (chunk_index(map, x, y) << (2*CHUNK_SHIFT)) + cell_bit(x, y);
+}
+
+inline bool in_bounds(const GridMap &map, const int x, const int y) {
+    return x >= 0 && y >= 0 && x < int(map.w) && y < int(map.h);
+}
+
+// anything outside the map counts as a wall, so rays always stop
+inline bool is_wall(const GridMap &map, const int x, const int y) {
+    if (!in_bounds(map, x, y)) return true;
+    return (map.occupancy[chunk_index(map, x, y)] >> cell_bit(x, y)) & 1u;
+}
+
+inline size_t texture_at(const GridMap &map, const int x, const int y) {
+    if (!in_bounds(map, x, y)) return 0;
+    uint32_t block = map.texture_blocks[chunk_index(map, x, y)];
+    if (block == EMPTY_CHUNK) return 0;
+    int bit = cell_bit(x, y);
+    return (map.textures[block + bit/2] >> ((bit & 1) * 4)) & 0xFu;
+}
+
+void init_map(GridMap &map, const size_t w, const size_t h) {
+    map.w = w;
+    map.h = h;
+    map.chunks_w = (w + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    map.chunks_h = (h + CHUNK_SIZE - 1) >> CHUNK_SHIFT;
+    map.occupancy.assign(map.chunks_w * map.chunks_h, 0);
+    map.texture_blocks.assign(map.chunks_w * map.chunks_h, EMPTY_CHUNK);
+    map.textures.clear();
+    map.distance.clear();
+    map.revision = 0;
+}
+
+// rays jump at most this many cells through open space in one step, the distance field saturates here
+const int MAX_SKIP_DISTANCE = 32;
+const int MIN_SKIP_DISTANCE = 3; // a jump costs a few multiplies and a floor, not worth it to cross just one cell
+
+// Chebyshev distance transform of the window of ww x wh cells at (x0, y0), into field with a one cell border around
+// the window. Cells outside the map count as walls, so rays never jump past its edge; border cells inside the map that
+// aren't walls are unknown and start out far away. Two raster passes, each cell taking one more than the smallest of
+// its already visited neighbours, give the exact chessboard distance.
+void distance_transform(const GridMap &map, const int x0, const int y0, const int ww, const int wh, std::vector<uint8_t> &field) {
+    const int pw = ww + 2;
+    field.resize(pw * (wh + 2));
+    for (int j = 0; j < wh + 2; j++) {
+        for (int i = 0; i < pw; i++) {
+            field[i + j*pw] = is_wall(map, x0 + i - 1, y0 + j - 1) ? 0 : MAX_SKIP_DISTANCE;
+        }
+    }
+    for (int j = 1; j <= wh; j++) {
+        for (int i = 1; i <= ww; i++) {
+            uint8_t &d = field[i + j*pw];
+            int nearest = std::min(std::min(field[i-1 + j*pw], field[i-1 + (j-1)*pw]), std::min(field[i + (j-1)*pw], field[i+1 + (j-1)*pw]));
+            d = std::min<int>(d, nearest + 1);
+        }
+    }
+    for (int j = wh; j >= 1; j--) {
+        for (int i = ww; i >= 1; i--) {
+            uint8_t &d = field[i + j*pw];
+            int nearest = std::min(std::min(field[i+1 + j*pw], field[i+1 + (j+1)*pw]), std::min(field[i + (j+1)*pw], field[i-1 + (j+1)*pw]));
+            d = std::min<int>(d, nearest + 1);
+        }
+    }
+}
+
+void build_distance_field(GridMap &map) {
+    std::vector<uint8_t> field;
+    distance_transform(map, 0, 0, map.w, map.h, field);
+    map.distance.assign(map.occupancy.size() << (2*CHUNK_SHIFT), 0);
+    for (size_t j = 0; j < map.h; j++) {
+        for (size_t i = 0; i < map.w; i++) map.distance[distance_index(map, i, j)] = field[i+1 + (j+1)*(map.w+2)];
+    }
+}
+
+// an edit at (x, y) can only change distances within MAX_SKIP_DISTANCE of it, and those only depend on walls within
+// twice that, so the transform is redone on that window and just its middle is kept
+void update_distance_field(GridMap &map, const int x, const int y) {
+    const int inner_x0 = std::max(x - MAX_SKIP_DISTANCE, 0), inner_x1 = std::min(x + MAX_SKIP_DISTANCE + 1, int(map.w));
+    const int inner_y0 = std::max(y - MAX_SKIP_DISTANCE, 0), inner_y1 = std::min(y + MAX_SKIP_DISTANCE + 1, int(map.h));
+    const int x0 = std::max(x - 2*MAX_SKIP_DISTANCE, 0), x1 = std::min(x + 2*MAX_SKIP_DISTANCE + 1, int(map.w));
+    const int y0 = std::max(y - 2*MAX_SKIP_DISTANCE, 0), y1 = std::min(y + 2*MAX_SKIP_DISTANCE + 1, int(map.h));
+    std::vector<uint8_t> &field = map.distance_scratch;
+    distance_transform(map, x0, y0, x1 - x0, y1 - y0, field);
+    const int pw = x1 - x0 + 2;
+    for (int j = inner_y0; j < inner_y1; j++) {
+        for (int i = inner_x0; i < inner_x1; i++) map.distance[distance_index(map, i, j)] = field[(i - x0 + 1) + (j - y0 + 1)*pw];
+    }
+}
+
+void set_cell(GridMap &map, const int x, const int y, const bool wall, const size_t texture_id = 0) {
+    assert(in_bounds(map, x, y) && texture_id < MAX_MAP_TEXTURES);
+    size_t chunk = chunk_index(map, x, y);
+    int bit = cell_bit(x, y);
+    map.revision++;
+    if (!wall) {
+        map.occupancy[chunk] &= ~(uint64_t(1) << bit);
+    } else {
+        if (map.texture_blocks[chunk] == EMPTY_CHUNK) { // first wall in this chunk, give it texture storage
+            map.texture_blocks[chunk] = map.textures.size();
+            map.textures.resize(map.textures.size() + CHUNK_TEXTURE_BYTES, 0);
+        }
+        uint8_t &ids = map.textures[map.texture_blocks[chunk] + bit/2];
+        int shift = (bit & 1) * 4;
+        ids = (ids & ~(0xF << shift)) | (texture_id << shift);
+        map.occupancy[chunk] |= uint64_t(1) << bit;
+    }
+    if (!map.distance.empty()) update_distance_field(map, x, y); // still empty while the map is loading
+}
+
+// the map can name up to MAX_MAP_TEXTURES textures, the loaded strip may have fewer. False at the first wall past it
+bool check_texture_ids(const GridMap &map, const size_t texture_count, int &bad_x, int &bad_y) {
+    for (size_t c = 0; c < map.texture_blocks.size(); c++) {
+        if (map.texture_blocks[c] == EMPTY_CHUNK) continue;
+        const int chunk_x = int(c % map.chunks_w) << CHUNK_SHIFT;
+        const int chunk_y = int(c / map.chunks_w) << CHUNK_SHIFT;
+        for (int bit = 0; bit < CHUNK_SIZE*CHUNK_SIZE; bit++) {
+            if (!((map.occupancy[c] >> bit) & 1u)) continue;
+            bad_x = chunk_x + (bit & (CHUNK_SIZE-1));
+            bad_y = chunk_y + (bit >> CHUNK_SHIFT);
+            if (texture_at(map, bad_x, bad_y) >= texture_count) return false;
+        }
+    }
+    return true;
+}
+
+size_t map_bytes(const GridMap &map) {
+    return map.occupancy.capacity() * sizeof(uint64_t) + map.texture_blocks.capacity() * sizeof(uint32_t) + map.textures.capacity() + map.distance.capacity();
+}
+
+// map files: a "width height" line, then one line per row where ' ' is open floor and '0'-'9' is a wall with that texture,
+// then optional "player x y angle", "sprite x y texture", "light x y intensity radius" and "ambient level" lines
+bool load_map(const std::string filename, GridMap &map, float &player_x, float &player_y, float &player_a, std::vector<Sprite> &sprites, std::vector<PointLight> &lights, float &ambient) {
+    Uint64 load_start = SDL_GetPerformanceCounter();
+    std::ifstream in(filename);
+    if (in.fail()) {
+        std::cerr << "Error: can not open the map " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    size_t w = 0, h = 0;
+    std::getline(in, line);
+    std::istringstream header(line);
+    if (!(header >> w >> h) || w == 0 || h == 0) {
+        std::cerr << "Error: the map must start with its width and height" << std::endl;
+        return false;
+    }
+    init_map(map, w, h);
+    for (size_t j = 0; j < h; j++) {
+        if (!std::getline(in, line)) {
+            std::cerr << "Error: the map ends after " << j << " of " << h << " rows" << std::endl;
+            return false;
+        }
+        // short rows are padded with open floor, editors like to strip trailing spaces
+        for (size_t i = 0; i < std::min(w, line.size()); i++) {
+            char cell = line[i];
+            if (cell == ' ' || cell == '\r') continue;
+            if (cell < '0' || cell > '9') {
+                std::cerr << "Error: unknown map cell '" << cell << "' at " << i << "," << j << std::endl;
+                return false;
+            }
+            set_cell(map, i, j, true, cell - '0');
+        }
+    }
+    sprites.clear();
+    lights.clear();
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        std::string keyword;
+        if (!(iss >> keyword) || keyword[0] == '#') continue;
+        if (keyword == "player") {
+            iss >> player_x >> player_y >> player_a;
+        } else if (keyword == "sprite") {
+            Sprite sprite;
+            if (iss >> sprite.x >> sprite.y >> sprite.texture_id) sprites.push_back(sprite);
+        } else if (keyword == "light") {
+            PointLight light;
+            if (iss >> light.x >> light.y >> light.intensity >> light.radius) lights.push_back(light);
+        } else if (keyword == "ambient") {
+            iss >> ambient;
+        }
+    }
+    map.textures.shrink_to_fit();
+    build_distance_field(map);
+
+    size_t used_chunks = 0;
+    for (size_t c = 0; c < map.texture_blocks.size(); c++) {
+        if (map.texture_blocks[c] != EMPTY_CHUNK) used_chunks++;
+    }
+    float load_ms = (SDL_GetPerformanceCounter() - load_start) * 1000.f / SDL_GetPerformanceFrequency();
+    std::cout << "Map " << filename << ": " << w << "x" << h << " cells, " << used_chunks << " of " << map.texture_blocks.size()
+              << " chunks used, " << map_bytes(map) / 1024.f << " KB (" << map_bytes(map) * 8.f / (w*h) << " bits/cell), loaded in "
+              << load_ms << " ms" << std::endl;
+    return true;
+}
+
+// the four sides of a wall cell, named by the direction they face
+enum Face {
+    FACE_WEST,
+    FACE_EAST,
+    FACE_NORTH,
+    FACE_SOUTH,
+    FACE_COUNT
+};
+
+struct RayHit {
+    float distance;    // along the unit ray direction
+    float wall_x;      // where along the wall face the ray landed, [0, 1)
+    size_t texture_id;
+    int side;          // 0 when the ray crossed a vertical grid line into the wall, 1 for a horizontal one
+    int map_x, map_y;  // the wall cell
+    int face;
+    int cells_visited;
+};
+
+// where a ray is in its walk over the grid
+struct DDAState {
+    int map_x, map_y;
+    int step_x, step_y;
+    float delta_x, delta_y; // ray length between two x / y grid lines
+    float inv_x, inv_y;     // 1/dx and 1/dy, so jumps don't divide
+    float side_x, side_y;   // ray length to the next x / y grid line
+    float t;                // ray length to where it entered the current cell
+    int side;
+};
+
+void init_dda(DDAState &state, const float ox, const float oy, const float dx, const float dy) {
+    state.map_x = floor(ox);
+    state.map_y = floor(oy);
+    state.step_x = dx < 0 ? -1 : 1;
+    state.step_y = dy < 0 ? -1 : 1;
+    state.inv_x = dx == 0 ? 1e30f : 1 / dx;
+    state.inv_y = dy == 0 ? 1e30f : 1 / dy;
+    state.delta_x = std::abs(state.inv_x);
+    state.delta_y = std::abs(state.inv_y);
+    state.side_x = dx == 0 ? 1e30f : ((state.map_x + (state.step_x > 0)) - ox) / dx;
+    state.side_y = dy == 0 ? 1e30f : ((state.map_y + (state.step_y > 0)) - oy) / dy;
+    state.t = 0;
+    state.side = 0;
+}
+
+void finish_hit(const GridMap &map, const float ox, const float oy, const float dx, const float dy, const DDAState &state, RayHit &hit) {
+    hit.distance = state.t;
+    hit.side = state.side;
+    hit.texture_id = texture_at(map, state.map_x, state.map_y);
+    hit.map_x = state.map_x;
+    hit.map_y = state.map_y;
+    if (state.side == 0) {
+        hit.face = state.step_x > 0 ? FACE_WEST : FACE_EAST;
+    } else {
+        hit.face = state.step_y > 0 ? FACE_NORTH : FACE_SOUTH;
+    }
+    float hit_x = ox + state.t*dx;
+    float hit_y = oy + state.t*dy;
+    hit.wall_x = state.side == 0 ? hit_y - floor(hit_y) : hit_x - floor(hit_x);
+}
+
+// moves the walk to the first cell past the box of open cells [x0, x1] x [y0, y1] around it, through whichever edge
+// of the box the ray reaches first
+inline void leave_box(DDAState &s, const float ox, const float oy, const float dx, const float dy, const int x0, const int y0, const int x1, const int y1) {
+    float exit_x = dx == 0 ? 1e30f : ((s.step_x > 0 ? x1 + 1 : x0) - ox) * s.inv_x;
+    float exit_y = dy == 0 ? 1e30f : ((s.step_y > 0 ? y1 + 1 : y0) - oy) * s.inv_y;
+    if (exit_x < exit_y) {
+        s.t = exit_x;
+        s.side = 0;
+        s.map_x = s.step_x > 0 ? x1 + 1 : x0 - 1;
+        s.map_y = std::min(std::max(int(floor(oy + s.t*dy)), y0), y1);
+    } else {
+        s.t = exit_y;
+        s.side = 1;
+        s.map_y = s.step_y > 0 ? y1 + 1 : y0 - 1;
+        s.map_x = std::min(std::max(int(floor(ox + s.t*dx)), x0), x1);
+    }
+    s.side_x = dx == 0 ? 1e30f : ((s.map_x + (s.step_x > 0)) - ox) * s.inv_x;
+    s.side_y = dy == 0 ? 1e30f : ((s.map_y + (s.step_y > 0)) - oy) * s.inv_y;
+}
+
+// what the walk does in a cell: stop on a wall or off the map, jump across open space, or take one DDA step
+enum CellVisit {
+    VISIT_STOP,
+    VISIT_JUMPED,
+    VISIT_STEP
+};
+
+// mask and d are the cell's chunk occupancy and distance, the walk is moved only for VISIT_JUMPED
+inline CellVisit classify_cell(const uint64_t mask, const int d) {
+    if (d > CHUNK_SIZE || mask == 0) return VISIT_JUMPED;
+    if (d == 0) return VISIT_STOP;
+    return d >= MIN_SKIP_DISTANCE ? VISIT_JUMPED : VISIT_STEP;
+}
+
+// an empty chunk on the right or bottom edge can hang past the map, its box is cut at the edge so the jump lands on the
+// first cell off the map like a step would
+inline void jump_open_space(const GridMap &map, DDAState &s, const float ox, const float oy, const float dx, const float dy, const uint64_t mask, const int d) {
+    if (d <= CHUNK_SIZE && mask == 0) {
+        int chunk_x = s.map_x & ~(CHUNK_SIZE-1);
+        int chunk_y = s.map_y & ~(CHUNK_SIZE-1);
+        leave_box(s, ox, oy, dx, dy, chunk_x, chunk_y, std::min(chunk_x + CHUNK_SIZE, int(map.w)) - 1, std::min(chunk_y + CHUNK_SIZE, int(map.h)) - 1);
+    } else { // every cell within d-1 of this one is open, past CHUNK_SIZE that covers the whole chunk and more
+        leave_box(s, ox, oy, dx, dy, s.map_x - (d-1), s.map_y - (d-1), s.map_x + (d-1), s.map_y + (d-1));
+    }
+}
+
+// grid DDA: steps from cell boundary to cell boundary next to walls and skips open space two ways. The distance field
+// gives the square of cells around the ray that is known to be open, and an empty chunk is crossed in one jump even
+// where the field is too short for that. The field is read in every cell, empty chunks too: in big rooms it allows
+// much longer jumps than the chunk, and that is worth more than the cache misses it costs on big maps.
+inline CellVisit visit_cell(const GridMap &map, const float ox, const float oy, const float dx, const float dy, DDAState &s, RayHit &hit) {
+    hit.cells_visited++;
+    if (!in_bounds(map, s.map_x, s.map_y)) return VISIT_STOP;
+    uint64_t mask = map.occupancy[chunk_index(map, s.map_x, s.map_y)];
+    const int d = map.distance[distance_index(map, s.map_x, s.map_y)];
+    CellVisit visit = classify_cell(mask, d);
+    if (visit == VISIT_JUMPED) jump_open_space(map, s, ox, oy, dx, dy, mask, d);
+    return visit;
+}
+
+void traceRay(const GridMap &map, const float ox, const float oy, const float dx, const float dy, DDAState &s, RayHit &hit) {
+    for (;;) {
+        CellVisit visit = visit_cell(map, ox, oy, dx, dy, s, hit);
+        if (visit == VISIT_STOP) break;
+        if (visit == VISIT_JUMPED) continue;
+        if (s.side_x < s.side_y) {
+            s.t = s.side_x;
+            s.side_x += s.delta_x;
+            s.map_x += s.step_x;
+            s.side = 0;
+        } else {
+            s.t = s.side_y;
+            s.side_y += s.delta_y;
+            s.map_y += s.step_y;
+            s.side = 1;
+        }
+    }
+    finish_hit(map, ox, oy, dx, dy, s, hit);
+}
+
+void castRay(const GridMap &map, const float ox, const float oy, const float dx, const float dy, RayHit &hit) {
+    DDAState state;
+    init_dda(state, ox, oy, dx, dy);
+    hit.cells_visited = 0;
+    traceRay(map, ox, oy, dx, dy, state, hit);
+}
+
+/* LIGHTING */
+// static light baked at load time from the map's point lights: one byte per wall face and per floor cell, 255 is full bright.
+// Like the texture ids it is stored per 8x8 chunk, and only chunks some light actually reaches get a block; every other
+// cell is at the ambient level.
+const float DEFAULT_AMBIENT = .25f;
+const float FACE_SAMPLE_OFFSET = 1e-3f; // face samples sit just in front of the wall so their shadow ray doesn't stop on it
+const size_t FLOOR_LIGHT_BYTES = CHUNK_SIZE*CHUNK_SIZE;
+const size_t FACE_LIGHT_BYTES = CHUNK_SIZE*CHUNK_SIZE*FACE_COUNT;
+
+struct LightMap {
+    bool lit;     // false when the map has no lights, everything is drawn full bright
+    uint8_t base; // the ambient level
+    size_t w, h;
+    size_t chunks_w;
+    std::vector<uint32_t> floor_blocks; // per chunk, offset of its floor levels in floor, or EMPTY_CHUNK
+    std::vector<uint32_t> face_blocks;  // per chunk, offset of its FACE_COUNT levels per cell in faces, or EMPTY_CHUNK
+    std::vector<uint8_t> floor;
+    std::vector<uint8_t> faces;
+};
+
+inline bool lightmap_covers(const LightMap &lights, const int x, const int y) {
+    return x >= 0 && y >= 0 && x < int(lights.w) && y < int(lights.h);
+}
+
+inline size_t light_chunk(const LightMap &lights, const int x, const int y) {
+    return (x >> CHUNK_SHIFT) + (y >> CHUNK_SHIFT) * lights.chunks_w;
+}
+
+inline uint8_t floor_light(const LightMap &lights, const int x, const int y) {
+    if (!lights.lit) return 255;
+    if (!lightmap_covers(lights, x, y)) return lights.base;
+    uint32_t block = lights.floor_blocks[light_chunk(lights, x, y)];
+    return block == EMPTY_CHUNK ? lights.base : lights.floor[block + cell_bit(x, y)];
+}
+
+// one multiply for red and blue together and one for green, alpha is kept
+inline uint32_t scale_color(const uint32_t color, const uint32_t light) {
+    uint32_t rb = ((color & 0x00ff00ffu) * light >> 8) & 0x00ff00ffu;
+    uint32_t g = ((color & 0x0000ff00u) * light >> 8) & 0x0000ff00u;
+    return (color & 0xff000000u) | rb | g;
+}
+
+inline uint8_t face_light(const LightMap &lights, const RayHit &hit) {
+    if (!lights.lit) return 255;
+    if (!lightmap_covers(lights, hit.map_x, hit.map_y)) return lights.base;
+    uint32_t block = lights.face_blocks[light_chunk(lights, hit.map_x, hit.map_y)];
+    return block == EMPTY_CHUNK ? lights.base : lights.faces[block + cell_bit(hit.map_x, hit.map_y)*FACE_COUNT + hit.face];
+}
+
+size_t lightmap_bytes(const LightMap &lights) {
+    return (lights.floor_blocks.capacity() + lights.face_blocks.capacity()) * sizeof(uint32_t) + lights.floor.capacity() + lights.faces.capacity();
+}
+
+// light from one source at (x, y), facing is the cosine between the surface normal and the direction to the light
+float light_contribution(const GridMap &map, const PointLight &light, const float x, const float y, const float facing) {
+    if (facing <= 0) return 0;
+    float to_x = x - light.x;
+    float to_y = y - light.y;
+    float distance = sqrt(to_x*to_x + to_y*to_y);
+    if (distance >= light.radius) return 0;
+    if (distance > 1e-4f) { // shadow ray: anything the grid walk hits before the sample blocks the light
+        RayHit hit;
+        castRay(map, light.x, light.y, to_x / distance, to_y / distance, hit);
+        if (hit.distance < distance) return 0;
+    }
+    float falloff = 1 - distance / light.radius;
+    return light.intensity * falloff * falloff * facing;
+}
+
+// adds to one level in a chunk's block, the block is made at the ambient level the first time any light reaches the chunk
+void add_light(std::vector<uint32_t> &blocks, std::vector<uint8_t> &levels, const size_t block_bytes, const uint8_t base, const size_t chunk, const size_t slot, const float amount) {
+    int added = int(amount * 255);
+    if (added <= 0) return;
+    if (blocks[chunk] == EMPTY_CHUNK) {
+        blocks[chunk] = levels.size();
+        levels.resize(levels.size() + block_bytes, base);
+    }
+    uint8_t &level = levels[blocks[chunk] + slot];
+    level = std::min(255, level + added);
+}
+
+void bake_lightmap(const GridMap &map, const std::vector<PointLight> &lights, const float ambient, LightMap &lightmap) {
+    lightmap.lit = !lights.empty();
+    lightmap.floor_blocks.clear();
+    lightmap.face_blocks.clear();
+    lightmap.floor.clear();
+    lightmap.faces.clear();
+    if (!lightmap.lit) return;
+    Uint64 bake_start = SDL_GetPerformanceCounter();
+    lightmap.w = map.w;
+    lightmap.h = map.h;
+    lightmap.chunks_w = map.chunks_w;
+    lightmap.base = std::min(255, int(ambient * 255));
+    lightmap.floor_blocks.assign(map.chunks_w * map.chunks_h, EMPTY_CHUNK);
+    lightmap.face_blocks.assign(map.chunks_w * map.chunks_h, EMPTY_CHUNK);
+    const int face_dx[FACE_COUNT] = {-1, 1, 0, 0};
+    const int face_dy[FACE_COUNT] = {0, 0, -1, 1};
+    for (size_t l = 0; l < lights.size(); l++) {
+        const PointLight &light = lights[l];
+        int x0 = std::max(0, int(floor(light.x - light.radius)));
+        int y0 = std::max(0, int(floor(light.y - light.radius)));
+        int x1 = std::min(int(map.w) - 1, int(light.x + light.radius));
+        int y1 = std::min(int(map.h) - 1, int(light.y + light.radius));
+        for (int cy = y0; cy <= y1; cy++) {
+            for (int cx = x0; cx <= x1; cx++) {
+                size_t chunk = chunk_index(map, cx, cy);
+                int bit = cell_bit(cx, cy);
+                if (!is_wall(map, cx, cy)) {
+                    add_light(lightmap.floor_blocks, lightmap.floor, FLOOR_LIGHT_BYTES, lightmap.base, chunk, bit,
+                              light_contribution(map, light, cx + .5f, cy + .5f, 1.f));
+                    continue;
+                }
+                for (int f = 0; f < FACE_COUNT; f++) {
+                    if (is_wall(map, cx + face_dx[f], cy + face_dy[f])) continue; // hidden face
+                    // the middle of the face, nudged out into the open cell
+                    float sx = cx + .5f + face_dx[f] * (.5f + FACE_SAMPLE_OFFSET);
+                    float sy = cy + .5f + face_dy[f] * (.5f + FACE_SAMPLE_OFFSET);
+                    float to_light_x = light.x - sx;
+                    float to_light_y = light.y - sy;
+                    float length = std::max(sqrt(to_light_x*to_light_x + to_light_y*to_light_y), 1e-4f);
+                    float facing = (face_dx[f] * to_light_x + face_dy[f] * to_light_y) / length;
+                    add_light(lightmap.face_blocks, lightmap.faces, FACE_LIGHT_BYTES, lightmap.base, chunk, bit*FACE_COUNT + f,
+                              light_contribution(map, light, sx, sy, facing));
+                }
+            }
+        }
+    }
+    float bake_ms = (SDL_GetPerformanceCounter() - bake_start) * 1000.f / SDL_GetPerformanceFrequency();
+    size_t lit_chunks = 0;
+    for (size_t c = 0; c < lightmap.floor_blocks.size(); c++) {
+        if (lightmap.floor_blocks[c] != EMPTY_CHUNK || lightmap.face_blocks[c] != EMPTY_CHUNK) lit_chunks++;
+    }
+    std::cout << "Lightmap: " << lights.size() << " lights, " << lit_chunks << " of " << lightmap.floor_blocks.size() << " chunks lit, "
+              << lightmap_bytes(lightmap) / 1024.f << " KB, map and lightmap " << (map_bytes(map) + lightmap_bytes(lightmap)) / 1024.f
+              << " KB, baked in " << bake_ms << " ms" << std::endl;
+}
+
+/* MINIMAP */
+// the minimap shows at most a MINIMAP_CELLS square window of the grid, scrolled to keep the player in view on big maps
+const size_t MINIMAP_CELLS = 16;
+
+struct MinimapView {
+    int origin_x, origin_y; // top left cell of the window
+    size_t cells_w, cells_h;
+    size_t rect_w, rect_h;  // pixels per cell
+    size_t panel_w, panel_h;
+};
+
+MinimapView minimapView(const GridMap &map, const size_t panel_w, const size_t panel_h, const float player_x, const float player_y) {
+    MinimapView mini;
+    mini.cells_w = std::min(map.w, MINIMAP_CELLS);
+    mini.cells_h = std::min(map.h, MINIMAP_CELLS);
+    mini.origin_x = std::min(std::max(int(player_x) - int(mini.cells_w/2), 0), int(map.w - mini.cells_w));
+    mini.origin_y = std::min(std::max(int(player_y) - int(mini.cells_h/2), 0), int(map.h - mini.cells_h));
+    mini.rect_w = panel_w / mini.cells_w;
+    mini.rect_h = panel_h / mini.cells_h;
+    mini.panel_w = panel_w;
+    mini.panel_h = panel_h;
+    return mini;
+}
+
+// map coordinates to minimap pixels, false when the point is outside the panel
+inline bool minimap_pixel(const MinimapView &mini, const float x, const float y, int &px, int &py) {
+    px = (x - mini.origin_x) * mini.rect_w;
+    py = (y - mini.origin_y) * mini.rect_h;
+    return x >= mini.origin_x && y >= mini.origin_y && px < int(mini.panel_w) && py < int(mini.panel_h);
+}
+
+void drawSprites(PixelTarget &framebuffer, const MinimapView &mini, const std::vector<Sprite> &sprites) {
     for (size_t i=0; i < sprites.size(); i++) {
-        draw_rectangle(framebuffer, win_w, win_h, red, (sprites[i].x * map_w)-3, (sprites[i].y * map_h)-3, 6, 6);
+        int px, py;
+        if (!minimap_pixel(mini, sprites[i].x, sprites[i].y, px, py)) continue;
+        if (px < 3 || py < 3 || px + 3 > int(mini.panel_w) || py + 3 > int(mini.panel_h)) continue;
+        draw_rectangle(framebuffer, red, px-3, py-3, 6, 6);
     }
 }
 
-void drawMap(const size_t win_w, const size_t win_h, std::vector<uint32_t> &framebuffer, const std::vector<uint32_t> &wall_textures, size_t wall_texture_size, const size_t map_w, const size_t map_h, const char *map, const size_t rect_w, const size_t rect_h) {// draw the map
-    for (size_t j = 0; j < map_h; j++) {
-        for (size_t i = 0; i <map_w; i++) {
-            if (map[i+j*map_w] == ' ') continue;
-            size_t rect_x = i * rect_w;
-            size_t rect_y = j * rect_h;
-//            size_t current_color = getMapColor(map[i+j*map_w]);
-//            draw_rectangle(framebuffer, win_w, win_h, current_color, rect_x, rect_y, rect_w, rect_h);
-            size_t texture_id = int(map[i+j*map_w] - '0');
-            draw_rectangle(framebuffer, win_w, win_h, wall_textures[texture_id*wall_texture_size], rect_x, rect_y, rect_w, rect_h);
+void drawMap(PixelTarget &framebuffer, const MinimapView &mini, const std::vector<uint32_t> &wall_textures, size_t wall_texture_size, const GridMap &map, const LightMap &lights) {// draw the map
+    for (size_t j = 0; j < mini.cells_h; j++) {
+        for (size_t i = 0; i < mini.cells_w; i++) {
+            int cell_x = mini.origin_x + i;
+            int cell_y = mini.origin_y + j;
+            size_t rect_x = i * mini.rect_w;
+            size_t rect_y = j * mini.rect_h;
+            if (!is_wall(map, cell_x, cell_y)) {
+                // the floor is only ever seen here, so this is where its baked light shows
+                if (lights.lit) draw_rectangle(framebuffer, scale_color(white, floor_light(lights, cell_x, cell_y)), rect_x, rect_y, mini.rect_w, mini.rect_h);
+                continue;
+            }
+            size_t texture_id = texture_at(map, cell_x, cell_y);
+            draw_rectangle(framebuffer, wall_textures[texture_id*wall_texture_size], rect_x, rect_y, mini.rect_w, mini.rect_h);
         }
     }
 }
 
-std::vector<uint32_t> getTextureColumn(const std::vector<uint32_t> &wall_textures, size_t wall_texture_size, size_t wall_texture_count, size_t texture_id, int texture_x_coord, size_t column_height) {
+// the static part of the minimap, pre-rendered and reused until the window scrolls or the map is edited
+struct MinimapCache {
+    std::vector<uint32_t> pixels;
+    bool valid;
+    int origin_x, origin_y;
+    uint32_t revision;
+    int rebuilds;
+};
+
+void updateMinimapCache(MinimapCache &cache, const MinimapView &mini, const std::vector<uint32_t> &wall_textures, size_t wall_texture_size, const GridMap &map, const LightMap &lights) {
+    if (cache.valid && cache.origin_x == mini.origin_x && cache.origin_y == mini.origin_y && cache.revision == map.revision) return;
+    cache.pixels.resize(mini.panel_w * mini.panel_h);
+    PixelTarget target = pixel_target(cache.pixels, mini.panel_w, mini.panel_h);
+    clear_target(target, white);
+    drawMap(target, mini, wall_textures, wall_texture_size, map, lights);
+    cache.valid = true;
+    cache.origin_x = mini.origin_x;
+    cache.origin_y = mini.origin_y;
+    cache.revision = map.revision;
+    cache.rebuilds++;
+}
+
+// samples rows [first_row, first_row + row_count) of a column_height tall strip into column, only the part that lands on screen
+template <class Texel> void getTextureColumn(Texel *column, const Texel *wall_textures, size_t wall_texture_size, size_t wall_texture_count, size_t texture_id, int texture_x_coord, size_t column_height, size_t first_row, size_t row_count) {
     const size_t texture_w = wall_texture_size*wall_texture_count;
-    const size_t texture_h = wall_texture_size;
-    std::vector<uint32_t> column(column_height);
-    for (size_t y = 0; y < column_height; y++) {
-        size_t px = texture_id * wall_texture_size + texture_x_coord;
-        size_t py = (y * wall_texture_size) / column_height;
+    const size_t px = texture_id * wall_texture_size + texture_x_coord;
+    for (size_t y = 0; y < row_count; y++) {
+        size_t py = ((first_row + y) * wall_texture_size) / column_height;
         column[y] = wall_textures[px + py * texture_w];
     }
-    return column;
-}
-
-void drawConeAndProjection(const size_t win_w, const size_t win_h, std::vector<uint32_t> &framebuffer, const std::vector<uint32_t> &wall_textures, size_t wall_texture_size, size_t wall_texture_count, const size_t map_w, const char *map, float player_x, float player_y, float player_a, const float fov, const size_t rect_w, const size_t rect_h) {
-    for (size_t i = 0; i < win_w / 2; i++) { // sweep to have 1 ray for each column of the view image
-        float angle = player_a - fov / 2 + fov * i / float(win_w/2); // calculate the line of sweeping the fov cone by calculating the new angle in radians
-        for ( float c = 0; c < 20; c += .05) {
-            float cx = player_x + c * cos(angle);
-            float cy = player_y + c * sin(angle);
-            int px = cx*rect_w;
-            int py = cy*rect_h;
-            framebuffer[px + py*win_w] = gray; // draw the cone
-            if (map[int(cx) + int(cy) * map_w] != ' ') {
-                size_t texture_id = int(map[int(cx) + int(cy) * map_w] - '0');
-                size_t column_height = win_h/(c*cos(angle-player_a)); // full height (win_h) * size of column (1/c) to get proportional size of column
-
-                float hit_x = cx - floor(cx + .5);  // these are the fractional parts of where we hit the wall
-                float hit_y = cy - floor(cy + .5);  // they dictate how far away from the intersection of the map gridlines we are, and therefore how far into the texture
-                int texture_coord_x = hit_x * wall_texture_size;
-                if (std::abs(hit_y) > std::abs(hit_x)) { // are we a "vertical" or "horizontal" wall wrt the map tile...i.e. we may be sliding along the edge and need to ID the correct texture to use
-                    texture_coord_x = hit_y * wall_texture_size;
-                }
-                if (texture_coord_x < 0) texture_coord_x += wall_texture_size; //this can go negative...fix it
+}
 
-                std::vector<uint32_t> column = getTextureColumn(wall_textures, wall_texture_size, wall_texture_count, texture_id, texture_coord_x, column_height);
+// per-column ray setup for the 3D view, rebuilt only when the internal resolution changes
+struct ViewTables {
+    size_t view_w, view_h;
+    std::vector<float> ray_cos; // cos/sin of each column's angle offset from the view direction, cos doubles as the fish-eye correction
+    std::vector<float> ray_sin;
+};
 
-                px = win_w/2+i;
-                for (size_t j=0; j < column_height; j++) {
-                    py = j + win_h/2-column_height/2;
-                    if (py < 0 || py >= (int) win_h) continue;
-                    framebuffer[px + py * win_w] = column[j];
-                }
-                break;
+void buildViewTables(ViewTables &tables, const size_t view_w, const size_t view_h, const float fov) {
+    tables.view_w = view_w;
+    tables.view_h = view_h;
+    tables.ray_cos.resize(view_w);
+    tables.ray_sin.resize(view_w);
+    for (size_t i = 0; i < view_w; i++) {
+        float offset = -fov / 2 + fov * i / float(view_w);
+        tables.ray_cos[i] = cos(offset);
+        tables.ray_sin[i] = sin(offset);
+    }
+}
+
+const float MIN_RESOLUTION_SCALE = 0.25;
+const float RESOLUTION_SCALE_STEP = 0.125;
+const int RESOLUTION_SAMPLE_FRAMES = 15;
+
+// picks the 3D view's internal resolution from the measured render time, averaged over a few frames so it doesn't oscillate
+struct ResolutionScaler {
+    bool enabled;
+    float scale;
+    float target_ms;
+    float total_ms;
+    int samples;
+};
+
+void updateResolutionScale(ResolutionScaler &scaler, const float render_ms) {
+    if (!scaler.enabled) return;
+    scaler.total_ms += render_ms;
+    scaler.samples++;
+    if (scaler.samples < RESOLUTION_SAMPLE_FRAMES) return;
+    float average_ms = scaler.total_ms / scaler.samples;
+    scaler.total_ms = 0;
+    scaler.samples = 0;
+    if (average_ms > scaler.target_ms) {
+        scaler.scale = std::max(MIN_RESOLUTION_SCALE, scaler.scale - RESOLUTION_SCALE_STEP);
+    } else if (average_ms < scaler.target_ms * 0.7f) { // headroom before growing again, otherwise we bounce between two steps
+        scaler.scale = std::min(1.f, scaler.scale + RESOLUTION_SCALE_STEP);
+    }
+}
+
+/* FRAME */
+struct Scene {
+    GridMap map;
+    std::vector<Sprite> sprites;
+    std::vector<uint32_t> wall_textures;
+    size_t wall_texture_size;
+    size_t wall_texture_count;
+    MipChain wall_mips;
+    IndexedTextures wall_indexed;
+    std::vector<PointLight> point_lights; // kept to rebake after map edits
+    float ambient;
+    LightMap lights;
+};
+
+bool load_scene(const std::string map_file, Scene &scene, float &player_x, float &player_y, float &player_a) {
+    scene.ambient = DEFAULT_AMBIENT;
+    if (!load_map(map_file, scene.map, player_x, player_y, player_a, scene.sprites, scene.point_lights, scene.ambient)) {
+        std::cerr << "Failed to load map" << std::endl;
+        return false;
+    }
+    if (!load_texture("./res/walltextures.png", scene.wall_textures, scene.wall_texture_size, scene.wall_texture_count)) {
+        std::cerr << "Failed to load wall textures" << std::endl;
+        return false;
+    }
+    int bad_x, bad_y;
+    if (!check_texture_ids(scene.map, scene.wall_texture_count, bad_x, bad_y)) {
+        std::cerr << "Error: the wall at " << bad_x << "," << bad_y << " uses texture " << texture_at(scene.map, bad_x, bad_y)
+                  << ", there are only " << scene.wall_texture_count << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < scene.sprites.size(); i++) {
+        if (scene.sprites[i].texture_id >= scene.wall_texture_count) {
+            std::cerr << "Error: sprite " << i << " uses texture " << scene.sprites[i].texture_id << ", there are only "
+                      << scene.wall_texture_count << std::endl;
+            return false;
+        }
+    }
+    build_mip_chain(scene.wall_textures, scene.wall_texture_size, scene.wall_texture_count, scene.wall_mips);
+    build_indexed_textures(scene.wall_mips, white, scene.wall_indexed);
+    bake_lightmap(scene.map, scene.point_lights, scene.ambient, scene.lights);
+    return true;
+}
+
+// the cell 1.5 units in front of the player, false if that is the player's own cell or on the map border
+bool cell_ahead(const GridMap &map, const float player_x, const float player_y, const float player_a, int &x, int &y) {
+    x = int(player_x + 1.5f*cos(player_a));
+    y = int(player_y + 1.5f*sin(player_a));
+    return x > 0 && y > 0 && x < int(map.w) - 1 && y < int(map.h) - 1 && !(x == int(player_x) && y == int(player_y));
+}
+
+// debug edit: adds or removes the wall in the cell in front of the player and rebakes the light if a light reaches the cell
+void toggle_wall_ahead(Scene &scene, const float player_x, const float player_y, const float player_a) {
+    GridMap &map = scene.map;
+    int x, y;
+    if (!cell_ahead(map, player_x, player_y, player_a, x, y)) return;
+    const bool wall = !is_wall(map, x, y);
+    Uint64 edit_start = SDL_GetPerformanceCounter();
+    set_cell(map, x, y, wall);
+    float edit_ms = (SDL_GetPerformanceCounter() - edit_start) * 1000.f / SDL_GetPerformanceFrequency();
+    std::cout << (wall ? "Added" : "Removed") << " the wall at " << x << "," << y << ", distance field updated in " << edit_ms << " ms" << std::endl;
+
+    for (size_t l = 0; l < scene.point_lights.size(); l++) {
+        const PointLight &light = scene.point_lights[l];
+        if (std::abs(x + .5f - light.x) <= light.radius + 1 && std::abs(y + .5f - light.y) <= light.radius + 1) {
+            bake_lightmap(map, scene.point_lights, scene.ambient, scene.lights);
+            break;
+        }
+    }
+}
+
+enum RenderPass {
+    PASS_CAST,
+    PASS_WALLS,
+    PASS_SPRITES,
+    PASS_MAP,
+    PASS_UPLOAD,
+    PASS_COUNT
+};
+
+const char *PASS_NAMES[PASS_COUNT] = {"cast", "wall texturing", "sprites", "map overlay", "upload"};
+
+// times the passes of one frame, each lap charges the time since the previous one to a pass
+struct PassTimer {
+    Uint64 last;
+    float ms[PASS_COUNT];
+};
+
+void start_passes(PassTimer &timer) {
+    for (int p = 0; p < PASS_COUNT; p++) timer.ms[p] = 0;
+    timer.last = SDL_GetPerformanceCounter();
+}
+
+void lap(PassTimer &timer, const RenderPass pass) {
+    Uint64 now = SDL_GetPerformanceCounter();
+    timer.ms[pass] += (now - timer.last) * 1000.f / SDL_GetPerformanceFrequency();
+    timer.last = now;
+}
+
+float total_ms(const PassTimer &timer) {
+    float total = 0;
+    for (int p = 0; p < PASS_COUNT; p++) total += timer.ms[p];
+    return total;
+}
+
+bool castRays(FrameArena &arena, RayHit *hits, const ViewTables &tables, const GridMap &map, float player_x, float player_y, float player_a) {
+    const float view_cos = cos(player_a);
+    const float view_sin = sin(player_a);
+    float *dir_x = arena.alloc<float>(tables.view_w);
+    float *dir_y = arena.alloc<float>(tables.view_w);
+    if (dir_x == nullptr || dir_y == nullptr) return false;
+    for (size_t i = 0; i < tables.view_w; i++) { // sweep to have 1 ray for each column of the view image
+        // rotate the column's precomputed offset by the view angle instead of calling cos/sin per ray
+        dir_x[i] = view_cos * tables.ray_cos[i] - view_sin * tables.ray_sin[i];
+        dir_y[i] = view_sin * tables.ray_cos[i] + view_cos * tables.ray_sin[i];
+    }
+    for (size_t i = 0; i < tables.view_w; i++) {
+        castRay(map, player_x, player_y, dir_x[i], dir_y[i], hits[i]);
+    }
+    return true;
+}
+
+// view_indexed selects the 8 bit pipeline: columns are written as shaded palette indices and expanded once at the end
+void drawWalls(FrameArena &arena, PixelTarget &view, uint8_t *view_indexed, const ViewTables &tables, const RayHit *hits, const Scene &scene) {
+    const size_t view_w = tables.view_w;
+    const size_t view_h = tables.view_h;
+    assert(view.w == view_w && view.h == view_h);
+    const size_t wall_texture_size = scene.wall_texture_size;
+    const MipChain &wall_mips = scene.wall_mips;
+    if (view_indexed != nullptr) {
+        memset(view_indexed, 0, view_w*view_h); // palette entry 0 is the clear color
+    } else {
+        clear_target(view, white);
+    }
+    for (size_t i = 0; i < view_w; i++) {
+        float distance = std::max(hits[i].distance * tables.ray_cos[i], 1e-3f); // distance along the view direction, no fish-eye
+        size_t column_height = view_h / distance; // full height (view_h) * size of column (1/distance) to get proportional size of column
+        int texture_coord_x = std::min<int>(hits[i].wall_x * wall_texture_size, wall_texture_size - 1);
+
+        //clip the strip to the screen before sampling, tall columns up close would otherwise sample thousands of hidden rows
+        int column_top = int(view_h/2) - int(column_height/2);
+        size_t first_row = column_top < 0 ? -column_top : 0;
+        size_t last_row = std::min(column_height, view_h - column_top);
+        if (first_row >= last_row) continue;
+        size_t row_count = last_row - first_row;
+
+        size_t level = mip_level(wall_mips, wall_texture_size, column_height);
+        const uint32_t light = face_light(scene.lights, hits[i]);
+        size_t arena_mark = arena.mark();
+        if (view_indexed != nullptr) {
+            uint8_t *column = arena.alloc<uint8_t>(row_count);
+            if (column == nullptr) break;
+            getTextureColumn(column, scene.wall_indexed.texels.data() + wall_mips.offsets[level], wall_texture_size >> level, scene.wall_texture_count, hits[i].texture_id, texture_coord_x >> level, column_height, first_row, row_count);
+            const uint8_t *shade = scene.wall_indexed.colormap[light_level(distance) * (light + 1) >> 8];
+            for (size_t j=0; j < row_count; j++) {
+                size_t py = column_top + first_row + j;
+                view_indexed[i + py * view_w] = shade[column[j]];
+            }
+        } else {
+            uint32_t *column = arena.alloc<uint32_t>(row_count);
+            if (column == nullptr) break;
+            getTextureColumn(column, wall_mips.texels.data() + wall_mips.offsets[level], wall_texture_size >> level, scene.wall_texture_count, hits[i].texture_id, texture_coord_x >> level, column_height, first_row, row_count);
+            if (light < 255) {
+                for (size_t j=0; j < row_count; j++) column[j] = scale_color(column[j], light);
             }
+            for (size_t j=0; j < row_count; j++) {
+                size_t py = column_top + first_row + j;
+                view.pixels[i + py * view.pitch] = column[j];
+            }
+        }
+        arena.release(arena_mark);
+    }
+    if (view_indexed != nullptr) {
+        expand_palette(view, view_indexed, scene.wall_indexed.palette);
+    }
+}
+
+void drawCone(PixelTarget &framebuffer, const MinimapView &mini, const ViewTables &tables, const RayHit *hits, float player_x, float player_y, float player_a) {
+    const float view_cos = cos(player_a);
+    const float view_sin = sin(player_a);
+    for (size_t i = 0; i < tables.view_w; i++) {
+        float dir_x = view_cos * tables.ray_cos[i] - view_sin * tables.ray_sin[i];
+        float dir_y = view_sin * tables.ray_cos[i] + view_cos * tables.ray_sin[i];
+        for (float c = 0; c < hits[i].distance; c += .05) {
+            int px, py;
+            if (!minimap_pixel(mini, player_x + c * dir_x, player_y + c * dir_y, px, py)) break;
+            framebuffer.pixels[px + py*framebuffer.pitch] = gray;
+        }
+    }
+}
+
+// what castRays and drawWalls take from the arena at this view size, with room for alignment
+size_t frame_arena_bytes(const ViewTables &tables) {
+    return tables.view_w * (sizeof(RayHit) + 2*sizeof(float)) + tables.view_h * sizeof(uint32_t) + 64;
+}
+
+// everything up to the upload, which differs between the window and the benchmark.
+// Both targets are written in full every frame, so they can point straight at locked texture memory
+void renderFrame(PassTimer &timer, FrameArena &arena, MinimapCache &minimap, PixelTarget &framebuffer, PixelTarget &view, uint8_t *view_indexed, const ViewTables &tables, const Scene &scene, float player_x, float player_y, float player_a) {
+    start_passes(timer);
+    arena.reset(frame_arena_bytes(tables));
+    RayHit *hits = arena.alloc<RayHit>(tables.view_w);
+    if (hits == nullptr || !castRays(arena, hits, tables, scene.map, player_x, player_y, player_a)) {
+        std::cerr << "Error: the frame arena is too small for a " << tables.view_w << "x" << tables.view_h << " view" << std::endl;
+        return;
+    }
+    lap(timer, PASS_CAST);
+
+    drawWalls(arena, view, view_indexed, tables, hits, scene);
+    lap(timer, PASS_WALLS);
+
+    MinimapView mini = minimapView(scene.map, framebuffer.w, framebuffer.h, player_x, player_y);
+    updateMinimapCache(minimap, mini, scene.wall_textures, scene.wall_texture_size, scene.map, scene.lights);
+    copy_target(framebuffer, pixel_target(minimap.pixels, mini.panel_w, mini.panel_h));
+    drawCone(framebuffer, mini, tables, hits, player_x, player_y, player_a);
+    lap(timer, PASS_MAP);
+
+    drawSprites(framebuffer, mini, scene.sprites);
+    lap(timer, PASS_SPRITES);
+}
+
+// points target at the texture memory. The old contents are undefined after a lock, every pixel must be written before unlocking
+bool lock_texture(SDL_Texture *texture, const SDL_Rect *rect, const size_t w, const size_t h, PixelTarget &target) {
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, rect, &pixels, &pitch) != 0) {
+        return false;
+    }
+    assert(pitch % sizeof(uint32_t) == 0);
+    PixelTarget locked = {static_cast<uint32_t *>(pixels), w, h, size_t(pitch) / sizeof(uint32_t)};
+    target = locked;
+    return true;
+}
+
+/* BENCHMARK */
+struct CameraKey {
+    float x, y, a;
+    int frames; // frames spent moving here from the previous key
+};
+
+// camera paths: one "x y angle [frames]" key per line, the camera moves linearly from key to key
+bool load_camera_path(const std::string filename, std::vector<CameraKey> &keys) {
+    std::ifstream in(filename);
+    if (in.fail()) {
+        std::cerr << "Error: can not open the camera path " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        CameraKey key = {0, 0, 0, 1};
+        if (line.empty() || line[0] == '#') continue;
+        if (!(iss >> key.x >> key.y >> key.a)) {
+            std::cerr << "Error: bad camera key '" << line << "'" << std::endl;
+            return false;
+        }
+        iss >> key.frames;
+        keys.push_back(key);
+    }
+    if (keys.empty()) {
+        std::cerr << "Error: the camera path is empty" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void report_pass(const char *name, std::vector<float> &samples) {
+    std::sort(samples.begin(), samples.end());
+    float median = samples[samples.size() / 2];
+    float p99 = samples[std::min(samples.size() - 1, size_t(samples.size() * 0.99))];
+    printf("%-16s %9.3f %9.3f %9.3f\n", name, samples.front(), median, p99);
+}
+
+// replays a camera path without a window, the upload pass copies into a staging buffer standing in for the streaming textures.
+// With zero_copy the frame is drawn straight into the staging buffer at a padded pitch, like a locked texture, and nothing is copied.
+// Each pose is also cast a second time outside the pass timers, to count the cells the rays visit.
+// Last, a few map edits along the path time the incremental distance field update and check it
+bool runBenchmark(const std::string path_file, const std::string map_file, const size_t view_w, const size_t view_h, const bool indexed, const bool zero_copy) {
+    Scene scene;
+    float player_x, player_y, player_a;
+    std::vector<CameraKey> keys;
+    if (!load_scene(map_file, scene, player_x, player_y, player_a) || !load_camera_path(path_file, keys)) {
+        return false;
+    }
+    std::vector<CameraKey> poses(1, keys[0]);
+    for (size_t k = 1; k < keys.size(); k++) {
+        for (int f = 1; f <= keys[k].frames; f++) {
+            float t = float(f) / keys[k].frames;
+            CameraKey pose = {keys[k-1].x + (keys[k].x - keys[k-1].x) * t, keys[k-1].y + (keys[k].y - keys[k-1].y) * t,
+                              keys[k-1].a + (keys[k].a - keys[k-1].a) * t, 1};
+            poses.push_back(pose);
+        }
+    }
+
+    const size_t panel_w = SCREEN_WIDTH / 2;
+    std::vector<uint32_t> framebuffer(panel_w*SCREEN_HEIGHT, white);
+    std::vector<uint32_t> view(view_w*view_h, white);
+    std::vector<uint8_t> view_indexed(view_w*view_h, 0);
+    const size_t panel_pitch = (panel_w + 15) & ~size_t(15); // drivers tend to pad texture rows to 64 bytes
+    const size_t view_pitch = (view_w + 15) & ~size_t(15);
+    std::vector<uint32_t> staging(std::max(framebuffer.size() + view.size(), panel_pitch*SCREEN_HEIGHT + view_pitch*view_h));
+    PixelTarget panel_target = pixel_target(framebuffer, panel_w, SCREEN_HEIGHT);
+    PixelTarget view_target = pixel_target(view, view_w, view_h);
+    if (zero_copy) {
+        PixelTarget locked_panel = {staging.data(), panel_w, SCREEN_HEIGHT, panel_pitch};
+        PixelTarget locked_view = {staging.data() + panel_pitch*SCREEN_HEIGHT, view_w, view_h, view_pitch};
+        panel_target = locked_panel;
+        view_target = locked_view;
+    }
+    ViewTables tables;
+    buildViewTables(tables, view_w, view_h, M_PI / 3.0);
+    FrameArena arena(1 << 20);
+    PassTimer timer;
+    MinimapCache minimap = {};
+    std::vector<std::vector<float>> samples(PASS_COUNT + 1, std::vector<float>(poses.size()));
+    std::vector<float> cast_samples(poses.size());
+    std::vector<RayHit> compare_hits(view_w);
+    double cells_visited = 0, cells_crossed = 0;
+
+    for (size_t f = 0; f < poses.size(); f++) {
+        renderFrame(timer, arena, minimap, panel_target, view_target, indexed ? view_indexed.data() : nullptr, tables, scene, poses[f].x, poses[f].y, poses[f].a);
+        if (!zero_copy) {
+            memcpy(staging.data(), framebuffer.data(), framebuffer.size() * sizeof(uint32_t));
+            memcpy(staging.data() + framebuffer.size(), view.data(), view.size() * sizeof(uint32_t));
+        }
+        lap(timer, PASS_UPLOAD);
+        for (int p = 0; p < PASS_COUNT; p++) samples[p][f] = timer.ms[p];
+        samples[PASS_COUNT][f] = total_ms(timer);
+
+        PassTimer compare;
+        start_passes(compare);
+        arena.reset(frame_arena_bytes(tables));
+        castRays(arena, compare_hits.data(), tables, scene.map, poses[f].x, poses[f].y, poses[f].a);
+        lap(compare, PASS_CAST);
+        cast_samples[f] = compare.ms[PASS_CAST];
+        for (size_t i = 0; i < view_w; i++) {
+            // a plain DDA visits every cell the ray crosses: one per grid line, plus the start
+            cells_visited += compare_hits[i].cells_visited;
+            cells_crossed += std::abs(compare_hits[i].map_x - int(floor(poses[f].x))) + std::abs(compare_hits[i].map_y - int(floor(poses[f].y))) + 1;
         }
     }
 
+    printf("Benchmark: %s on %zux%zu map, view %zux%zu%s%s, %zu frames\n", path_file.c_str(), scene.map.w, scene.map.h, view_w, view_h,
+           indexed ? " indexed" : "", zero_copy ? " zero-copy" : "", poses.size());
+    printf("%-16s %9s %9s %9s\n", "pass (ms)", "min", "median", "p99");
+    for (int p = 0; p < PASS_COUNT; p++) report_pass(PASS_NAMES[p], samples[p]);
+    report_pass("total", samples[PASS_COUNT]);
+    printf("minimap rebuilds: %d\n", minimap.rebuilds);
+    printf("%-16s %9s %9s %9s\n", "cast (ms)", "min", "median", "p99");
+    report_pass("single rays", cast_samples);
+    const double rays = double(view_w) * poses.size();
+    printf("cells visited per ray: %.2f, plain DDA would visit %.2f (%.1fx fewer)\n", cells_visited / rays, cells_crossed / rays, cells_crossed / cells_visited);
+
+    // toggles the wall ahead of up to BENCH_EDITS poses and puts it back, checking the incremental distance field
+    // against a full rebuild each time
+    const size_t BENCH_EDITS = 16;
+    std::vector<float> edit_samples, rebuild_samples;
+    int mismatches = 0;
+    GridMap rebuilt;
+    for (size_t f = 0; f < poses.size() && edit_samples.size() < BENCH_EDITS; f += std::max<size_t>(1, poses.size() / BENCH_EDITS)) {
+        int x, y;
+        if (!cell_ahead(scene.map, poses[f].x, poses[f].y, poses[f].a, x, y)) continue;
+        const bool wall = is_wall(scene.map, x, y);
+        Uint64 start = SDL_GetPerformanceCounter();
+        set_cell(scene.map, x, y, !wall);
+        edit_samples.push_back((SDL_GetPerformanceCounter() - start) * 1000.f / SDL_GetPerformanceFrequency());
+        rebuilt = scene.map;
+        start = SDL_GetPerformanceCounter();
+        build_distance_field(rebuilt);
+        rebuild_samples.push_back((SDL_GetPerformanceCounter() - start) * 1000.f / SDL_GetPerformanceFrequency());
+        if (rebuilt.distance != scene.map.distance) mismatches++;
+        set_cell(scene.map, x, y, wall);
+    }
+    if (!edit_samples.empty()) {
+        printf("%-16s %9s %9s %9s\n", "map edit (ms)", "min", "median", "p99");
+        report_pass("incremental", edit_samples);
+        report_pass("full rebuild", rebuild_samples);
+        printf("distance field after %zu edits: %d differ from the full rebuild\n", edit_samples.size(), mismatches);
+    }
+    return true;
 }
 
 int main(int argc, char **argv) {
+    // raycaster [map] [--bench camera_path] [--res width height] [--indexed] [--copy]
+    std::string map_file = "./res/raycaster_map.txt";
+    std::string bench_path;
+    size_t bench_w = SCREEN_WIDTH / 2;
+    size_t bench_h = SCREEN_HEIGHT;
+    bool indexed = false;
+    bool zero_copy = true;
+    for (int a = 1; a < argc; a++) {
+        if (!strcmp(argv[a], "--bench") && a + 1 < argc) {
+            bench_path = argv[++a];
+        } else if (!strcmp(argv[a], "--indexed")) {
+            indexed = true;
+        } else if (!strcmp(argv[a], "--copy")) {
+            zero_copy = false;
+        } else if (!strcmp(argv[a], "--res") && a + 2 < argc) {
+            bench_w = std::max(8, atoi(argv[++a]));
+            bench_h = std::max(8, atoi(argv[++a]));
+        } else {
+            map_file = argv[a];
+        }
+    }
+    if (!bench_path.empty()) {
+        return runBenchmark(bench_path, map_file, bench_w, bench_h, indexed, zero_copy) ? 0 : 1;
+    }
+
     if (!init()) {
         std::cout << "Initialization Failed" << std::endl;
     } else {
@@ -199,51 +1421,45 @@ int main(int argc, char **argv) {
 
             const size_t win_w = SCREEN_WIDTH; // image width
             const size_t win_h = SCREEN_HEIGHT; // image height
+            const size_t panel_w = win_w / 2; // map on the left half, 3D view on the right
 
-
-            const size_t map_w = 16;
-            const size_t map_h = 16;
-            const char map[] =  "0002222222220000"\
-                                "1              0"\
-                                "1      11111   0"\
-                                "1     0        0"\
-                                "0     0  1110000"\
-                                "0     3        0"\
-                                "0   10000      0"\
-                                "0   3   11100  0"\
-                                "5   4   0      0"\
-                                "5   4   1  00000"\
-                                "0       1      0"\
-                                "2       1      0"\
-                                "0       0      0"\
-                                "0 0000000      0"\
-                                "0              0"\
-                                "0002222222200000";
-
+            Scene scene;
             float player_x = 3.456;
             float player_y = 2.345;
             float player_a = 1.523;
             const float fov = M_PI / 3.0; //60 deg field of view (pi/3 rad)
             const float fov_degree = 2*M_PI / 360.0;
 
-            std::vector<Sprite> sprites{ {1.834, 8.765, 0}, {5.323, 5.365, 1}, {4.123, 10.265, 1} };
-
-            const size_t rect_w = win_w / (map_w*2);
-            const size_t rect_h = win_h / map_h;
+            if (!load_scene(map_file, scene, player_x, player_y, player_a)) {
+                quit = true;
+            }
 
-            std::vector<uint32_t> wall_textures;
-            size_t wall_texture_size;
-            size_t wall_texture_count;
+            std::vector<uint32_t> framebuffer(panel_w*win_h, white); // the map panel, initialized to white
+            framebuffer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, panel_w, win_h);
 
-            if (!load_texture("./res/walltextures.png", wall_textures, wall_texture_size, wall_texture_count)) {
-                std::cerr << "Failed to load wall textures" << std::endl;
-            }
+            // the 3D view renders at a variable internal resolution into the top left of a full size buffer and texture,
+            // the SDL copy stretches that region over the right half of the window
+            std::vector<uint32_t> view(panel_w*win_h, white);
+            std::vector<uint8_t> view_indexed(panel_w*win_h, 0);
+            view_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, panel_w, win_h);
+            const SDL_Rect minimap_rect = {0, 0, int(panel_w), int(win_h)};
+            const SDL_Rect view_rect = {int(panel_w), 0, int(panel_w), int(win_h)};
 
-            std::vector<uint32_t> framebuffer(win_w*win_h, white); // the image itself, initialized to white
-            framebuffer_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH, SCREEN_HEIGHT);
+            ViewTables tables;
+            tables.ray_cos.reserve(panel_w);
+            tables.ray_sin.reserve(panel_w);
+            buildViewTables(tables, panel_w, win_h, fov);
+            ResolutionScaler scaler = {true, 1.f, 8.f, 0.f, 0};
 
             int frame_delay = 5;
 
+            FrameArena arena(1 << 20);
+            PassTimer timer;
+            MinimapCache minimap = {};
+            const int warmup_frames = 2;
+            int frame_count = 0;
+            int allocating_frames = 0;
+
             while (!quit) {
                 SDL_Event event;
                 while (SDL_PollEvent(&event) != 0) {
@@ -258,6 +1474,19 @@ int main(int argc, char **argv) {
                             case SDLK_1:
                                 rotate = !rotate;
                                 break;
+                            case SDLK_2:
+                                scaler.enabled = !scaler.enabled;
+                                if (!scaler.enabled) scaler.scale = 1.f;
+                                break;
+                            case SDLK_3:
+                                indexed = !indexed;
+                                break;
+                            case SDLK_5:
+                                zero_copy = !zero_copy;
+                                break;
+                            case SDLK_6:
+                                toggle_wall_ahead(scene, player_x, player_y, player_a);
+                                break;
                         }
                     }
                 }
@@ -271,19 +1500,53 @@ int main(int argc, char **argv) {
                     }
                 }
 
-                framebuffer = std::vector<uint32_t>(win_w*win_h, white); //clear screen
-
-                drawMap(win_w, win_h, framebuffer, wall_textures, wall_texture_size, map_w, map_h, map, rect_w, rect_h);
-                drawConeAndProjection(win_w, win_h, framebuffer, wall_textures, wall_texture_size, wall_texture_count, map_w, map, player_x, player_y, player_a, fov, rect_w, rect_h);
+                size_t view_w = std::max<size_t>(8, panel_w * scaler.scale);
+                size_t view_h = std::max<size_t>(8, win_h * scaler.scale);
+                if (view_w != tables.view_w || view_h != tables.view_h) {
+                    buildViewTables(tables, view_w, view_h, fov);
+                }
 
-                drawSprites(win_w, win_h, framebuffer, sprites, rect_h, rect_w);
+                size_t frame_allocations = heap_allocations;
+                const SDL_Rect view_src = {0, 0, int(view_w), int(view_h)};
+                PixelTarget panel_target = pixel_target(framebuffer, panel_w, win_h);
+                PixelTarget view_target = pixel_target(view, view_w, view_h);
+                bool locked = false;
+                if (zero_copy && lock_texture(framebuffer_texture, NULL, panel_w, win_h, panel_target)) {
+                    locked = lock_texture(view_texture, &view_src, view_w, view_h, view_target);
+                    if (!locked) {
+                        SDL_UnlockTexture(framebuffer_texture);
+                        panel_target = pixel_target(framebuffer, panel_w, win_h);
+                    }
+                }
+                if (zero_copy && !locked) {
+                    std::cerr << "Warning: can not lock the streaming textures, falling back to copied uploads. SDL Error: " << SDL_GetError() << std::endl;
+                    zero_copy = false;
+                }
+                renderFrame(timer, arena, minimap, panel_target, view_target, indexed ? view_indexed.data() : nullptr, tables, scene, player_x, player_y, player_a);
 
-                SDL_UpdateTexture(framebuffer_texture, NULL, reinterpret_cast<void *>(framebuffer.data()), SCREEN_WIDTH*4);
+                if (locked) {
+                    SDL_UnlockTexture(framebuffer_texture);
+                    SDL_UnlockTexture(view_texture);
+                } else {
+                    SDL_UpdateTexture(framebuffer_texture, NULL, reinterpret_cast<void *>(framebuffer.data()), panel_w*4);
+                    SDL_UpdateTexture(view_texture, &view_src, reinterpret_cast<void *>(view.data()), view_w*4);
+                }
+                lap(timer, PASS_UPLOAD);
+                updateResolutionScale(scaler, total_ms(timer));
 
                 SDL_RenderClear(renderer);
-                SDL_RenderCopy(renderer, framebuffer_texture, NULL, NULL);
+                SDL_RenderCopy(renderer, framebuffer_texture, NULL, &minimap_rect);
+                SDL_RenderCopy(renderer, view_texture, &view_src, &view_rect);
                 SDL_RenderPresent(renderer);
+
+                if (frame_count >= warmup_frames && heap_allocations != frame_allocations) {
+                    allocating_frames++;
+                }
+                frame_count++;
             }
+            std::cout << "Frames: " << frame_count << ", steady-state frames with heap allocations: " << allocating_frames
+                      << ", arena high water: " << arena.get_high_water() << " bytes, minimap rebuilds: " << minimap.rebuilds
+                      << ", uploads: " << (zero_copy ? "zero-copy" : "copied") << std::endl;
         }
     }
     close();
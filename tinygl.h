@@ -87,6 +87,12 @@ struct VertexData2D {
     t2f texture_coordinate;
 };
 
+struct VertexData3D {
+    v3f position;
+    v3f normal;
+    t2f texture_coordinate;
+};
+
 /* OPENGL THINGS */
 
 struct FRect {
@@ -96,6 +102,84 @@ struct FRect {
     GLfloat h;
 };
 
+//column major, the layout glUniformMatrix4fv takes
+struct Matrix4 {
+    GLfloat m[16];
+};
+
+Matrix4 identity_matrix() {
+    Matrix4 matrix = {{1.f, 0.f, 0.f, 0.f,  0.f, 1.f, 0.f, 0.f,  0.f, 0.f, 1.f, 0.f,  0.f, 0.f, 0.f, 1.f}};
+    return matrix;
+}
+
+//same matrix glOrtho multiplies in
+Matrix4 ortho_matrix(GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat near, GLfloat far) {
+    Matrix4 matrix = identity_matrix();
+    matrix.m[0] = 2.f / (right - left);
+    matrix.m[5] = 2.f / (top - bottom);
+    matrix.m[10] = -2.f / (far - near);
+    matrix.m[12] = -(right + left) / (right - left);
+    matrix.m[13] = -(top + bottom) / (top - bottom);
+    matrix.m[14] = -(far + near) / (far - near);
+    return matrix;
+}
+
+Matrix4 translation_matrix(GLfloat x, GLfloat y, GLfloat z) {
+    Matrix4 matrix = identity_matrix();
+    matrix.m[12] = x;
+    matrix.m[13] = y;
+    matrix.m[14] = z;
+    return matrix;
+}
+
+Matrix4 scale_matrix(GLfloat x, GLfloat y, GLfloat z) {
+    Matrix4 matrix = identity_matrix();
+    matrix.m[0] = x;
+    matrix.m[5] = y;
+    matrix.m[10] = z;
+    return matrix;
+}
+
+Matrix4 operator *(const Matrix4& a, const Matrix4& b) {
+    Matrix4 product;
+    for (int column = 0; column < 4; column++) {
+        for (int row = 0; row < 4; row++) {
+            GLfloat sum = 0.f;
+            for (int k = 0; k < 4; k++) {
+                sum += a.m[k*4 + row] * b.m[column*4 + k];
+            }
+            product.m[column*4 + row] = sum;
+        }
+    }
+    return product;
+}
+
+//per frame counters, every draw call in here adds to them
+struct RenderStats {
+    int draw_calls;
+    int vertices;
+    int texture_uploads;
+    int upload_bytes;
+    int state_calls;
+    int elided_state_calls;
+};
+
+RenderStats render_stats = {0, 0, 0, 0, 0, 0};
+
+void reset_render_stats() {
+    render_stats.draw_calls = 0;
+    render_stats.vertices = 0;
+    render_stats.texture_uploads = 0;
+    render_stats.upload_bytes = 0;
+    render_stats.state_calls = 0;
+    render_stats.elided_state_calls = 0;
+}
+
+inline void count_draw_call(int vertices) {
+    render_stats.draw_calls++;
+    render_stats.vertices += vertices;
+}
+
 /* OBJ FORMAT*/
 class Model {
 public:
@@ -105,12 +189,24 @@ public:
     int num_faces();
     v3f vertex(int index);
     std::vector<int> face(int index);
+    bool generate_mesh();
+    void free_mesh();
+    void render();
 private:
     std::vector<v3f> vertexes;
+    std::vector<v3f> normals;
+    std::vector<t2f> texture_coordinates;
     std::vector<std::vector<int>> faces;
+    std::vector<v3i> corners; //vertex/texture/normal index of every face corner, in face order
+    //static mesh on the GPU, uploaded once by generate_mesh
+    GLuint VBO_id;
+    GLuint IBO_id;
+    GLenum index_type;
+    GLsizei index_count;
 };
 
-Model::Model(const char *filename) : vertexes(), faces() {
+Model::Model(const char *filename) : vertexes(), normals(), texture_coordinates(), faces(), corners(),
+                                     VBO_id(0), IBO_id(0), index_type(GL_UNSIGNED_SHORT), index_count(0) {
     std::ifstream in;
     in.open (filename, std::ifstream::in);
     if (in.fail()) return;
@@ -124,13 +220,24 @@ Model::Model(const char *filename) : vertexes(), faces() {
             v3f v;
             for (int i=0; i<3; i++) iss >> v.raw[i];
             vertexes.push_back(v);
+        } else if (!line.compare(0, 3, "vn ")) {
+            iss >> trash >> trash;
+            v3f n;
+            for (int i=0; i<3; i++) iss >> n.raw[i];
+            normals.push_back(n);
+        } else if (!line.compare(0, 3, "vt ")) {
+            iss >> trash >> trash;
+            t2f uv;
+            for (int i=0; i<2; i++) iss >> uv.raw[i];
+            texture_coordinates.push_back(uv);
         } else if (!line.compare(0, 2, "f ")) {
             std::vector<int> f;
-            int itrash, idx;
+            int idx, texture_idx, normal_idx;
             iss >> trash;
-            while (iss >> idx >> trash >> itrash >> trash >> itrash) {
+            while (iss >> idx >> trash >> texture_idx >> trash >> normal_idx) {
                 idx--;
                 f.push_back(idx);
+                corners.push_back(v3i(idx, texture_idx - 1, normal_idx - 1));
             }
             faces.push_back(f);
         }
@@ -138,7 +245,9 @@ Model::Model(const char *filename) : vertexes(), faces() {
     std::cerr << "# v# " << vertexes.size() << " f# " << faces.size() << std::endl;
 }
 
-Model::~Model() {}
+Model::~Model() {
+    free_mesh();
+}
 
 int Model::num_vertexes() {
     return (int) vertexes.size();
@@ -234,8 +343,316 @@ bool Timer::is_paused() {
     return paused && started;
 }
 
+/* GL STATE */
+//what tinygl last bound, so calls that wouldn't change anything never reach the driver. All binds in here go
+//through these. UNKNOWN_BINDING means anything could be bound, the next call always goes through
+const GLuint UNKNOWN_BINDING = 0xFFFFFFFF;
+
+struct GLStateCache {
+    GLuint texture;
+    GLuint array_buffer;
+    GLuint element_array_buffer; //part of the bound VAO, forgotten whenever that changes
+    GLuint pixel_unpack_buffer;
+    GLuint program;
+    GLuint vertex_array;
+    GLuint vertex_array_enabled; //client arrays, only the fixed function path on VAO 0 uses them
+    GLuint texture_coordinate_array_enabled;
+    GLuint normal_array_enabled;
+    GLenum blend_source;
+    GLenum blend_destination;
+};
+
+GLStateCache gl_state = {UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, 0,
+                         UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING, UNKNOWN_BINDING};
+
+//the shader path keeps one VAO per vertex format rather than one per buffer, each draw points the attributes at
+//its own buffer. Made on first use
+struct VertexFormatArray {
+    GLuint VAO_id;
+    GLuint attribute_buffer; //what the attribute pointers read from, 0 for none
+};
+
+VertexFormatArray vertex_format_2d = {0, 0};
+
+//after GL calls made outside tinygl. VAOs are left alone, only the shader path binds them and a 2.1
+//context doesn't have glBindVertexArray at all
+void invalidate_gl_state() {
+    gl_state.texture = UNKNOWN_BINDING;
+    gl_state.array_buffer = UNKNOWN_BINDING;
+    gl_state.element_array_buffer = UNKNOWN_BINDING;
+    gl_state.pixel_unpack_buffer = UNKNOWN_BINDING;
+    gl_state.program = UNKNOWN_BINDING;
+    gl_state.vertex_array_enabled = UNKNOWN_BINDING;
+    gl_state.texture_coordinate_array_enabled = UNKNOWN_BINDING;
+    gl_state.normal_array_enabled = UNKNOWN_BINDING;
+    gl_state.blend_source = UNKNOWN_BINDING;
+    gl_state.blend_destination = UNKNOWN_BINDING;
+}
+
+inline bool state_changed(GLuint& cached, GLuint value) {
+    if (cached == value) {
+        render_stats.elided_state_calls++;
+        return false;
+    }
+    cached = value;
+    render_stats.state_calls++;
+    return true;
+}
+
+void bind_texture(GLuint texture) {
+    if (state_changed(gl_state.texture, texture)) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+    }
+}
+
+void bind_buffer(GLenum target, GLuint buffer) {
+    GLuint* cached = &gl_state.array_buffer;
+    if (target == GL_ELEMENT_ARRAY_BUFFER) {
+        cached = &gl_state.element_array_buffer;
+    } else if (target == GL_PIXEL_UNPACK_BUFFER) {
+        cached = &gl_state.pixel_unpack_buffer;
+    }
+    if (state_changed(*cached, buffer)) {
+        glBindBuffer(target, buffer);
+    }
+}
+
+void use_program(GLuint program) {
+    if (state_changed(gl_state.program, program)) {
+        glUseProgram(program);
+    }
+}
+
+void bind_vertex_array(GLuint vertex_array) {
+    if (state_changed(gl_state.vertex_array, vertex_array)) {
+        glBindVertexArray(vertex_array);
+        gl_state.element_array_buffer = UNKNOWN_BINDING;
+    }
+}
+
+void set_client_state(GLenum array, bool enabled) {
+    GLuint* cached = &gl_state.texture_coordinate_array_enabled;
+    if (array == GL_VERTEX_ARRAY) {
+        cached = &gl_state.vertex_array_enabled;
+    } else if (array == GL_NORMAL_ARRAY) {
+        cached = &gl_state.normal_array_enabled;
+    }
+    if (state_changed(*cached, enabled ? GL_TRUE : GL_FALSE)) {
+        if (enabled) {
+            glEnableClientState(array);
+        } else {
+            glDisableClientState(array);
+        }
+    }
+}
+
+void blend_func(GLenum source, GLenum destination) {
+    if (source == gl_state.blend_source && destination == gl_state.blend_destination) {
+        render_stats.elided_state_calls++;
+        return;
+    }
+    gl_state.blend_source = source;
+    gl_state.blend_destination = destination;
+    render_stats.state_calls++;
+    glBlendFunc(source, destination);
+}
+
+//deleting a bound object binds 0 in its place
+void forget_texture(GLuint texture) {
+    if (gl_state.texture == texture) {
+        gl_state.texture = 0;
+    }
+}
+
+void forget_buffer(GLuint buffer) {
+    if (gl_state.array_buffer == buffer) {
+        gl_state.array_buffer = 0;
+    }
+    if (gl_state.element_array_buffer == buffer) {
+        gl_state.element_array_buffer = 0;
+    }
+    if (gl_state.pixel_unpack_buffer == buffer) {
+        gl_state.pixel_unpack_buffer = 0;
+    }
+    //a new buffer can come back with the same name
+    if (vertex_format_2d.attribute_buffer == buffer) {
+        vertex_format_2d.attribute_buffer = 0;
+    }
+}
+
+void forget_vertex_array(GLuint vertex_array) {
+    if (gl_state.vertex_array == vertex_array) {
+        gl_state.vertex_array = 0;
+        gl_state.element_array_buffer = UNKNOWN_BINDING;
+    }
+}
+
+/* MODEL MESH */
+//one interleaved vertex per distinct vertex/texture/normal corner, faces fanned into triangles
+bool Model::generate_mesh() {
+    free_mesh();
+    std::vector<VertexData3D> mesh_vertexes;
+    std::vector<GLuint> indices;
+    //corners already emitted, per position: texture index, normal index, mesh vertex
+    std::vector<std::vector<v3i>> emitted(vertexes.size());
+    const GLuint NOT_EMITTED = 0xFFFFFFFF;
+    size_t corner = 0;
+    for (size_t f = 0; f < faces.size(); f++) {
+        std::vector<GLuint> face_vertexes;
+        for (size_t i = 0; i < faces[f].size(); i++, corner++) {
+            v3i c = corners[corner];
+            if (c.x < 0 || c.x >= (int)vertexes.size()) {
+                printf("Model face %d uses missing vertex %d!\n", (int)f, c.x + 1);
+                return false;
+            }
+            GLuint mesh_vertex = NOT_EMITTED;
+            for (size_t e = 0; e < emitted[c.x].size(); e++) {
+                if (emitted[c.x][e].x == c.y && emitted[c.x][e].y == c.z) {
+                    mesh_vertex = emitted[c.x][e].z;
+                    break;
+                }
+            }
+            if (mesh_vertex == NOT_EMITTED) {
+                mesh_vertex = mesh_vertexes.size();
+                VertexData3D v;
+                v.position = vertexes[c.x];
+                if (c.z >= 0 && c.z < (int)normals.size()) {
+                    v.normal = normals[c.z];
+                }
+                if (c.y >= 0 && c.y < (int)texture_coordinates.size()) {
+                    v.texture_coordinate = texture_coordinates[c.y];
+                }
+                mesh_vertexes.push_back(v);
+                emitted[c.x].push_back(v3i(c.y, c.z, mesh_vertex));
+            }
+            face_vertexes.push_back(mesh_vertex);
+        }
+        for (size_t i = 2; i < face_vertexes.size(); i++) {
+            indices.push_back(face_vertexes[0]);
+            indices.push_back(face_vertexes[i - 1]);
+            indices.push_back(face_vertexes[i]);
+        }
+    }
+    if (indices.empty()) {
+        printf("Model has no faces to upload!\n");
+        return false;
+    }
+    index_count = indices.size();
+    glGenBuffers(1, &VBO_id);
+    bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+    glBufferData(GL_ARRAY_BUFFER, mesh_vertexes.size() * sizeof(VertexData3D), &mesh_vertexes[0], GL_STATIC_DRAW);
+    glGenBuffers(1, &IBO_id);
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, IBO_id);
+    //16 bit indices while the vertices fit in them, half the index memory and bandwidth
+    GLsizeiptr index_bytes = 0;
+    if (mesh_vertexes.size() <= 65536) {
+        index_type = GL_UNSIGNED_SHORT;
+        std::vector<GLushort> short_indices(indices.begin(), indices.end());
+        index_bytes = short_indices.size() * sizeof(GLushort);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, &short_indices[0], GL_STATIC_DRAW);
+    } else {
+        index_type = GL_UNSIGNED_INT;
+        index_bytes = indices.size() * sizeof(GLuint);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_bytes, &indices[0], GL_STATIC_DRAW);
+    }
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        logGLError(std::cout, "Error uploading model mesh!", error);
+        free_mesh();
+        return false;
+    }
+    printf("Model mesh: %d vertices, %d triangles, %d KB with %d bit indices\n", (int)mesh_vertexes.size(),
+           (int)index_count / 3, (int)((mesh_vertexes.size() * sizeof(VertexData3D) + index_bytes) / 1024),
+           index_type == GL_UNSIGNED_SHORT ? 16 : 32);
+    return true;
+}
+
+void Model::free_mesh() {
+    if (VBO_id != 0) {
+        forget_buffer(VBO_id);
+        forget_buffer(IBO_id);
+        glDeleteBuffers(1, &VBO_id);
+        glDeleteBuffers(1, &IBO_id);
+        VBO_id = 0;
+        IBO_id = 0;
+    }
+    index_count = 0;
+}
+
+//fixed function, the caller sets up the matrices, texture and lighting
+void Model::render() {
+    if (VBO_id == 0) {
+        return;
+    }
+    set_client_state(GL_VERTEX_ARRAY, true);
+    set_client_state(GL_TEXTURE_COORD_ARRAY, true);
+    set_client_state(GL_NORMAL_ARRAY, true);
+    bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+    glVertexPointer(3, GL_FLOAT, sizeof(VertexData3D), (GLvoid*)offsetof(VertexData3D, position));
+    glNormalPointer(GL_FLOAT, sizeof(VertexData3D), (GLvoid*)offsetof(VertexData3D, normal));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(VertexData3D), (GLvoid*)offsetof(VertexData3D, texture_coordinate));
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, IBO_id);
+    glDrawElements(GL_TRIANGLES, index_count, index_type, NULL);
+    count_draw_call(index_count);
+    //the 2D paths never set a normal pointer, so don't leave one reading this buffer
+    set_client_state(GL_NORMAL_ARRAY, false);
+}
+
+/* TEXTURE UPLOADS */
+//texture updates are staged through a ring of pixel buffer objects, glTexSubImage2D from a bound PBO returns
+//straight away and the driver copies on its own time. Each buffer is orphaned before it's refilled, so a
+//transfer still in flight never makes the CPU wait
+const int UPLOAD_RING_SIZE = 3;
+GLuint upload_ring[UPLOAD_RING_SIZE] = {0, 0, 0};
+int upload_ring_next = 0;
+
+GLuint next_upload_buffer() {
+    if (upload_ring[0] == 0) {
+        glGenBuffers(UPLOAD_RING_SIZE, upload_ring);
+    }
+    GLuint buffer = upload_ring[upload_ring_next];
+    upload_ring_next = (upload_ring_next + 1) % UPLOAD_RING_SIZE;
+    return buffer;
+}
+
+void free_upload_ring() {
+    if (upload_ring[0] != 0) {
+        glDeleteBuffers(UPLOAD_RING_SIZE, upload_ring);
+        for (int i = 0; i < UPLOAD_RING_SIZE; i++) {
+            forget_buffer(upload_ring[i]);
+            upload_ring[i] = 0;
+        }
+    }
+}
+
+/* TEXTURE MEMORY */
+//everything the live textures hold on the GPU, and how much of it is padding up to power of two sizes
+struct TextureMemory {
+    int textures;
+    size_t bytes;
+    size_t padding_bytes;
+};
+
+TextureMemory texture_memory = {0, 0, 0};
+
+GLuint bytes_per_pixel(GLenum pixel_mode) {
+    if (pixel_mode == GL_RED) {
+        return 1;
+    }
+    return pixel_mode == GL_RGB ? 3 : 4;
+}
+
+void print_texture_memory() {
+    printf("Textures: %d live, %.1f KB, %.1f KB of it padding\n", texture_memory.textures,
+           texture_memory.bytes / 1024.f, texture_memory.padding_bytes / 1024.f);
+}
+
 /* TEXTURE CLASSES */
+class TexturedPolygonProgram2D;
+
 GLenum DEFAULT_TEXTURE_WRAP = GL_REPEAT;
+//pad images to power of two sizes even when the context takes any size
+bool FORCE_POWER_OF_TWO_TEXTURES = false;
 
 class Texture {
 public:
@@ -246,27 +663,52 @@ public:
     bool load_pixels_from_file(std::string path);
     bool load_texture_from_pixels(GLuint* pixels, GLuint i_width, GLuint i_height, GLuint t_width, GLuint t_height);
     bool load_texture_from_pixels();
+    bool load_texture_from_rgba_pixels(GLuint* pixels, GLuint i_width, GLuint i_height, GLuint t_width, GLuint t_height);
+    bool load_texture_from_red_pixels(GLubyte* pixels, GLuint width, GLuint height);
     // bool load_from_rendered_text(std::string text, SDL_Color color = WHITE);
     virtual void free_texture();
     void render(GLfloat x, GLfloat y, FRect* clip = nullptr);
+    void render(TexturedPolygonProgram2D& program, GLfloat x, GLfloat y, FRect* clip = nullptr);
+    void make_quad(GLfloat x, GLfloat y, FRect* clip, VertexData2D* quad);
     GLuint get_texture_id();
     GLuint get_width();
     GLuint get_height();
     GLuint get_image_width();
     GLuint get_image_height();
     bool lock();
+    bool lock(GLuint x, GLuint y, GLuint w, GLuint h);
     bool unlock();
+    void mark_dirty(GLuint x, GLuint y, GLuint w, GLuint h);
+    void free_shadow_pixels();
+    //while locked, every call marks the whole locked region dirty since raw writes can't be tracked,
+    //set_pixel only marks the texel it writes
     GLuint* get_pixel_data();
     GLuint get_pixel(GLuint x, GLuint y);
     void set_pixel(GLuint x, GLuint y, GLuint pixel);
+    static GLuint power_of_two(GLuint number);
+    static bool npot_supported();
+    static GLuint storage_size(GLuint image_size);
 protected:
-    GLuint power_of_two(GLuint number);
+    void track_memory(bool live);
     GLenum detect_format(SDL_Surface* surface);
     void init_VBO();
     void free_VBO();
+    void upload_dirty_region();
     std::string file_path;
     GLuint texture_id;
+    //pixels waiting to become a texture, or once it exists the CPU shadow copy kept between locks
     GLuint* raw_pixels;
+    bool locked;
+    //texels written since lock(), right and bottom exclusive
+    GLuint dirty_left;
+    GLuint dirty_top;
+    GLuint dirty_right;
+    GLuint dirty_bottom;
+    //the region lock() was given, raw writes are assumed to stay inside it
+    GLuint lock_left;
+    GLuint lock_top;
+    GLuint lock_right;
+    GLuint lock_bottom;
     GLuint texture_width;
     GLuint texture_height;
     GLuint image_width;
@@ -279,6 +721,9 @@ protected:
 Texture::Texture() {
     texture_id = 0;
     raw_pixels = nullptr;
+    locked = false;
+    dirty_left = dirty_top = dirty_right = dirty_bottom = 0;
+    lock_left = lock_top = lock_right = lock_bottom = 0;
     image_width = 0;
     image_height = 0;
     texture_width = 0;
@@ -295,6 +740,8 @@ Texture::~Texture() {
 
 void Texture::free_texture() {
     if (texture_id != 0) {
+        track_memory(false);
+        forget_texture(texture_id);
         glDeleteTextures(1, &texture_id);
         texture_id = 0;
     }
@@ -303,6 +750,7 @@ void Texture::free_texture() {
         raw_pixels = nullptr;
         pixel_mode = 0;
     }
+    locked = false;
     image_width = 0;
     image_height = 0;
     texture_width = 0;
@@ -310,37 +758,106 @@ void Texture::free_texture() {
 }
 
 bool Texture::lock() {
-    //If we have member pixels, it means we've already locked the texture
-    if (raw_pixels == nullptr && texture_id != 0) {
+    if (locked || texture_id == 0) {
+        return false;
+    }
+    //only the first lock reads the texture back, after that the shadow copy is already current
+    if (raw_pixels == nullptr) {
         //Alloc memory for texture data
         GLuint size = texture_width * texture_height;
         raw_pixels = new GLuint[size];
         //Set current texture
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        bind_texture(texture_id);
         //Get pixels
         glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, raw_pixels);
         //Unbind texture
-        glBindTexture(GL_TEXTURE_2D, 0);
-        return true;
+        bind_texture(0);
+    }
+    locked = true;
+    dirty_left = dirty_top = dirty_right = dirty_bottom = 0;
+    lock_left = lock_top = 0;
+    lock_right = texture_width;
+    lock_bottom = texture_height;
+    return true;
+}
+
+//lock for writes through get_pixel_data() that stay inside the given region
+bool Texture::lock(GLuint x, GLuint y, GLuint w, GLuint h) {
+    if (!lock()) {
+        return false;
     }
-    return false;
+    lock_left = std::min(x, texture_width);
+    lock_top = std::min(y, texture_height);
+    lock_right = std::min(x + w, texture_width);
+    lock_bottom = std::min(y + h, texture_height);
+    mark_dirty(x, y, w, h);
+    return true;
 }
 
 bool Texture::unlock() {
-    //If texture is locked, and it exists
-    if (raw_pixels != nullptr && texture_id != 0) {
-        //Set current texture
-        glBindTexture(GL_TEXTURE_2D, texture_id);
-        //Update texture
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture_width, texture_height, GL_RGBA, GL_UNSIGNED_BYTE, raw_pixels);
-        //Delete pixels
+    if (!locked || texture_id == 0) {
+        return false;
+    }
+    if (dirty_right > dirty_left && dirty_bottom > dirty_top) {
+        upload_dirty_region();
+    }
+    locked = false;
+    return true;
+}
+
+void Texture::mark_dirty(GLuint x, GLuint y, GLuint w, GLuint h) {
+    GLuint right = std::min(x + w, texture_width);
+    GLuint bottom = std::min(y + h, texture_height);
+    if (right <= x || bottom <= y) {
+        return;
+    }
+    if (dirty_right <= dirty_left || dirty_bottom <= dirty_top) {
+        dirty_left = x;
+        dirty_top = y;
+        dirty_right = right;
+        dirty_bottom = bottom;
+    } else {
+        dirty_left = std::min(dirty_left, x);
+        dirty_top = std::min(dirty_top, y);
+        dirty_right = std::max(dirty_right, right);
+        dirty_bottom = std::max(dirty_bottom, bottom);
+    }
+}
+
+//drop the shadow copy to save memory, the next lock reads the texture back again
+void Texture::free_shadow_pixels() {
+    if (!locked && texture_id != 0 && raw_pixels != nullptr) {
         delete[] raw_pixels;
         raw_pixels = nullptr;
-        //Unbind texture
-        glBindTexture(GL_TEXTURE_2D, 0);
-        return true;
     }
-    return false;
+}
+
+void Texture::upload_dirty_region() {
+    GLuint w = dirty_right - dirty_left;
+    GLuint h = dirty_bottom - dirty_top;
+    GLsizeiptr bytes = w * h * sizeof(GLuint);
+    bind_texture(texture_id);
+    bind_buffer(GL_PIXEL_UNPACK_BUFFER, next_upload_buffer());
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    GLuint* staging = (GLuint*)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+    if (staging != nullptr) {
+        //pack the dirty rows tightly, the offset 0 below is into the bound buffer
+        for (GLuint row = 0; row < h; row++) {
+            memcpy(staging + row * w, raw_pixels + (dirty_top + row) * texture_width + dirty_left, w * sizeof(GLuint));
+        }
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, dirty_left, dirty_top, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+        bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+        //couldn't map, upload straight out of the shadow copy instead
+        bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, texture_width);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, dirty_left, dirty_top, w, h, GL_RGBA, GL_UNSIGNED_BYTE,
+                        raw_pixels + dirty_top * texture_width + dirty_left);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    }
+    render_stats.texture_uploads++;
+    render_stats.upload_bytes += bytes;
 }
 
 void Texture::init_VBO() {
@@ -356,25 +873,31 @@ void Texture::init_VBO() {
         index_data[3] = 3;
         //Create VBO
         glGenBuffers(1, &VBO_id);
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
+        bind_buffer(GL_ARRAY_BUFFER, VBO_id);
         glBufferData(GL_ARRAY_BUFFER, 4*sizeof(VertexData2D), vertex_data, GL_DYNAMIC_DRAW);
         //Create IBO
         glGenBuffers(1, &IBO_id);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO_id);
+        bind_buffer(GL_ELEMENT_ARRAY_BUFFER, IBO_id);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, 4*sizeof(GLfloat), index_data, GL_DYNAMIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        bind_buffer(GL_ARRAY_BUFFER, 0);
+        bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     }
 }
 
 void Texture::free_VBO() {
     if (VBO_id != 0) {
+        forget_buffer(VBO_id);
+        forget_buffer(IBO_id);
         glDeleteBuffers(1, &VBO_id);
         glDeleteBuffers(1, &IBO_id);
     }
 }
 
 GLuint* Texture::get_pixel_data() {
+    //writes through the raw pointer can't be tracked, assume they touch the whole locked region
+    if (locked) {
+        mark_dirty(lock_left, lock_top, lock_right - lock_left, lock_bottom - lock_top);
+    }
     return raw_pixels;
 }
 
@@ -384,6 +907,32 @@ GLuint Texture::get_pixel(GLuint x, GLuint y) {
 
 void Texture::set_pixel(GLuint x, GLuint y, GLuint pixel) {
     raw_pixels[y*texture_width+x] = pixel;
+    mark_dirty(x, y, 1, 1);
+}
+
+//non power of two textures are core since GL 2.0
+bool Texture::npot_supported() {
+    return !FORCE_POWER_OF_TWO_TEXTURES && (GLEW_VERSION_2_0 || GLEW_ARB_texture_non_power_of_two);
+}
+
+//texture dimension to store an image dimension in, padding only when the context needs it
+GLuint Texture::storage_size(GLuint image_size) {
+    return npot_supported() ? image_size : power_of_two(image_size);
+}
+
+//add this texture to the memory totals when it's created, take it out when it's deleted
+void Texture::track_memory(bool live) {
+    size_t bytes = (size_t)texture_width * texture_height * bytes_per_pixel(pixel_mode);
+    size_t padding_bytes = bytes - (size_t)image_width * image_height * bytes_per_pixel(pixel_mode);
+    if (live) {
+        texture_memory.textures++;
+        texture_memory.bytes += bytes;
+        texture_memory.padding_bytes += padding_bytes;
+    } else {
+        texture_memory.textures--;
+        texture_memory.bytes -= bytes;
+        texture_memory.padding_bytes -= padding_bytes;
+    }
 }
 
 GLuint Texture::power_of_two(GLuint number) {
@@ -444,13 +993,14 @@ bool Texture::load_texture_from_pixels() {
     bool success = true;
     if (texture_id == 0 && raw_pixels != nullptr) {
         glGenTextures(1, &texture_id);
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        bind_texture(texture_id);
         glTexImage2D(GL_TEXTURE_2D, 0, pixel_mode, texture_width, texture_height, 0, pixel_mode, GL_UNSIGNED_BYTE, raw_pixels);
+        track_memory(true);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, DEFAULT_TEXTURE_WRAP);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, DEFAULT_TEXTURE_WRAP);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        bind_texture(0);
         GLenum error = glGetError();
         if (error != GL_NO_ERROR) { 
             logGLError(std::cout, "Error loading texture from pixels!", error); 
@@ -482,13 +1032,14 @@ bool Texture::load_texture_from_pixels(GLuint* pixels, GLuint i_width, GLuint i_
     texture_width = t_width;
     texture_height = t_height;
     glGenTextures(1, &texture_id);
-    glBindTexture(GL_TEXTURE_2D, texture_id);
+    bind_texture(texture_id);
     glTexImage2D(GL_TEXTURE_2D, 0, pixel_mode, texture_width, texture_height, 0, pixel_mode, GL_UNSIGNED_BYTE, pixels);
+    track_memory(true);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, DEFAULT_TEXTURE_WRAP);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, DEFAULT_TEXTURE_WRAP);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    bind_texture(0);
     GLenum error = glGetError();
     if (error != GL_NO_ERROR) { 
         logGLError(std::cout, "Error loading texture from pixels!", error); 
@@ -499,6 +1050,18 @@ bool Texture::load_texture_from_pixels(GLuint* pixels, GLuint i_width, GLuint i_
     return success;
 }
 
+//for pixels built on the CPU, already RGBA and sized for storage
+bool Texture::load_texture_from_rgba_pixels(GLuint* pixels, GLuint i_width, GLuint i_height, GLuint t_width, GLuint t_height) {
+    pixel_mode = GL_RGBA;
+    return load_texture_from_pixels(pixels, i_width, i_height, t_width, t_height);
+}
+
+//one byte per texel, for the shader paths that read .r. Rows must stay 4 byte aligned
+bool Texture::load_texture_from_red_pixels(GLubyte* pixels, GLuint width, GLuint height) {
+    pixel_mode = GL_RED;
+    return load_texture_from_pixels((GLuint*)pixels, width, height, width, height);
+}
+
 bool Texture::load_texture_from_file(std::string path) {
     bool success = true;
     free_texture();
@@ -511,8 +1074,8 @@ bool Texture::load_texture_from_file(std::string path) {
         image_width = csurface->w;
         image_height = csurface->h;
         // Calculate texture dimensions needed
-        texture_width = power_of_two(image_width);
-        texture_height = power_of_two(image_height);
+        texture_width = storage_size(image_width);
+        texture_height = storage_size(image_height);
         if (image_width != texture_width || image_height != texture_height) {
             // std::cout << "not 2^n size image" << std::endl;
             // create new surface at desired size
@@ -572,8 +1135,8 @@ bool Texture::load_pixels_from_file(std::string path) {
         image_width = csurface->w;
         image_height = csurface->h;
         // Calculate texture dimensions needed
-        texture_width = power_of_two(image_width);
-        texture_height = power_of_two(image_height);
+        texture_width = storage_size(image_width);
+        texture_height = storage_size(image_height);
 
         GLuint size = texture_width * texture_height;
         raw_pixels = new GLuint[size];
@@ -624,46 +1187,51 @@ bool Texture::load_pixels_from_file(std::string path) {
 //     return texture != NULL;
 // }
 
+//fills the 4 corners of the image (or clip of it) with its top left at x, y
+void Texture::make_quad(GLfloat x, GLfloat y, FRect* clip, VertexData2D* quad) {
+    //Texture coordinates
+    GLfloat texture_top = 0.f;
+    GLfloat texture_bottom = (GLfloat)image_height / (GLfloat)texture_height;
+    GLfloat texture_left = 0.f;
+    GLfloat texture_right = (GLfloat)image_width / (GLfloat)texture_width;
+    //Vertex coordinates
+    GLfloat quad_width = image_width;
+    GLfloat quad_height = image_height;
+    //Handle clipping
+    if (clip != nullptr) {
+        texture_left = clip->x / texture_width;
+        texture_right = (clip->x + clip->w) / texture_width;
+        texture_top = clip->y / texture_height;
+        texture_bottom = (clip->y + clip->h) / texture_height;
+        quad_width = clip->w;
+        quad_height = clip->h;
+    }
+    //Texture coordinates
+    quad[0].texture_coordinate.s =  texture_left; quad[0].texture_coordinate.t =    texture_top;
+    quad[1].texture_coordinate.s = texture_right; quad[1].texture_coordinate.t =    texture_top;
+    quad[2].texture_coordinate.s = texture_right; quad[2].texture_coordinate.t = texture_bottom;
+    quad[3].texture_coordinate.s =  texture_left; quad[3].texture_coordinate.t = texture_bottom;
+    //Vertex positions
+    quad[0].position.x =              x; quad[0].position.y =               y;
+    quad[1].position.x = x + quad_width; quad[1].position.y =               y;
+    quad[2].position.x = x + quad_width; quad[2].position.y = y + quad_height;
+    quad[3].position.x =              x; quad[3].position.y = y + quad_height;
+}
+
 void Texture::render(GLfloat x, GLfloat y, FRect* clip) {
     if (texture_id != 0) {
-        //Texture coordinates
-        GLfloat texture_top = 0.f;
-        GLfloat texture_bottom = (GLfloat)image_height / (GLfloat)texture_height;
-        GLfloat texture_left = 0.f;
-        GLfloat texture_right = (GLfloat)image_width / (GLfloat)texture_width;
-        //Vertex coordinates
-        GLfloat quad_width = image_width;
-        GLfloat quad_height = image_height;
-        //Handle clipping
-        if (clip != nullptr) {
-            texture_left = clip->x / texture_width;
-            texture_right = (clip->x + clip->w) / texture_width;
-            texture_top = clip->y / texture_height;
-            texture_bottom = (clip->y + clip->h) / texture_height;
-            quad_width = clip->w;
-            quad_height = clip->h;
-        }
         //Move to rendering point
         glTranslatef(x, y, 0.f);
         //Set vertex data
         VertexData2D vertex_data[4];
-        //Texture coordinates
-        vertex_data[0].texture_coordinate.s =  texture_left; vertex_data[0].texture_coordinate.t =    texture_top;
-        vertex_data[1].texture_coordinate.s = texture_right; vertex_data[1].texture_coordinate.t =    texture_top;
-        vertex_data[2].texture_coordinate.s = texture_right; vertex_data[2].texture_coordinate.t = texture_bottom;
-        vertex_data[3].texture_coordinate.s =  texture_left; vertex_data[3].texture_coordinate.t = texture_bottom;
-        //Vertex positions
-        vertex_data[0].position.x =        0.f; vertex_data[0].position.y =         0.f;        
-        vertex_data[1].position.x = quad_width; vertex_data[1].position.y =         0.f;        
-        vertex_data[2].position.x = quad_width; vertex_data[2].position.y = quad_height;        
-        vertex_data[3].position.x =        0.f; vertex_data[3].position.y = quad_height;        
+        make_quad(0.f, 0.f, clip, vertex_data);
         //Set texture ID
-        glBindTexture(GL_TEXTURE_2D, texture_id);
+        bind_texture(texture_id);
         //Enable vertex and texture coordinate arrays
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        set_client_state(GL_VERTEX_ARRAY, true);
+        set_client_state(GL_TEXTURE_COORD_ARRAY, true);
         //Bind vertex buffer
-        glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
+        bind_buffer(GL_ARRAY_BUFFER, VBO_id);
         //Update vertex buffer data
         glBufferSubData(GL_ARRAY_BUFFER, 0, 4*sizeof(VertexData2D), vertex_data);
         //Set texture coordinate data
@@ -671,11 +1239,9 @@ void Texture::render(GLfloat x, GLfloat y, FRect* clip) {
         //Set vertex data
         glVertexPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, position));
         //Draw quad using vertex data and index data
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IBO_id);
+        bind_buffer(GL_ELEMENT_ARRAY_BUFFER, IBO_id);
         glDrawElements(GL_QUADS, 4, GL_UNSIGNED_INT, NULL);
-        //Disable Vertex and texture coordinate arrays
-        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-        glDisableClientState(GL_VERTEX_ARRAY);
+        count_draw_call(4);
     }
 }
 
@@ -718,13 +1284,17 @@ public:
     void free_sheet();
     void free_texture();
     void render_sprite(int index);
+    void render_sprite(TexturedPolygonProgram2D& program, int index);
+    void make_sprite_quad(int index, GLfloat x, GLfloat y, VertexData2D* quad);
 protected:
     std::vector<FRect> clips;
+    SpriteOrigin origin;
     GLuint vertex_data_buffer;
     GLuint* index_buffers;
 };
 
 SpriteSheet::SpriteSheet() {
+    origin = SPRITE_ORIGIN_CENTER;
     vertex_data_buffer = (GLuint)NULL;
     index_buffers = NULL;
 }
@@ -742,79 +1312,85 @@ FRect SpriteSheet::get_clip(int index) {
     return clips[index];
 }
 
-bool SpriteSheet::generate_data_buffer(SpriteOrigin origin) {
+//fills the 4 corners of a sprite placed with its origin at x, y
+void SpriteSheet::make_sprite_quad(int index, GLfloat x, GLfloat y, VertexData2D* quad) {
+    GLfloat tex_width = get_width();
+    GLfloat tex_height = get_height();
+    const FRect& clip = clips[index];
+    //for origin calculation
+    GLfloat vertex_top = 0.f;
+    GLfloat vertex_bottom = 0.f;
+    GLfloat vertex_left = 0.f;
+    GLfloat vertex_right = 0.f;
+    switch (origin) {
+        case SPRITE_ORIGIN_TOP_LEFT:
+            vertex_top = 0.f;
+            vertex_bottom = clip.h;
+            vertex_left = 0.f;
+            vertex_right = clip.w;
+            break;
+        case SPRITE_ORIGIN_TOP_RIGHT:
+            vertex_top = 0.f;
+            vertex_bottom = clip.h;
+            vertex_left = -clip.w;
+            vertex_right = 0.f;
+            break;
+        case SPRITE_ORIGIN_BOTTOM_LEFT:
+            vertex_top = -clip.h;
+            vertex_bottom = 0.f;
+            vertex_left = 0.f;
+            vertex_right = clip.w;
+            break;
+        case SPRITE_ORIGIN_BOTTOM_RIGHT:
+            vertex_top = -clip.h;
+            vertex_bottom = 0.f;
+            vertex_left = -clip.w;
+            vertex_right = 0.f;
+            break;
+        default: //SPRITE_ORIGIN_CENTER
+            vertex_top = -clip.h / 2.f;
+            vertex_bottom = clip.h / 2.f;
+            vertex_left = -clip.w / 2.f;
+            vertex_right = clip.w / 2.f;
+            break;
+    }
+    quad[0].position.x = x + vertex_left;
+    quad[0].position.y = y + vertex_top;
+    quad[0].texture_coordinate.s = (clip.x) / tex_width;
+    quad[0].texture_coordinate.t = (clip.y) / tex_height;
+    quad[1].position.x = x + vertex_right;
+    quad[1].position.y = y + vertex_top;
+    quad[1].texture_coordinate.s = (clip.x + clip.w) / tex_width;
+    quad[1].texture_coordinate.t = (clip.y) / tex_height;
+    quad[2].position.x = x + vertex_right;
+    quad[2].position.y = y + vertex_bottom;
+    quad[2].texture_coordinate.s = (clip.x + clip.w) / tex_width;
+    quad[2].texture_coordinate.t = (clip.y + clip.h) / tex_height;
+    quad[3].position.x = x + vertex_left;
+    quad[3].position.y = y + vertex_bottom;
+    quad[3].texture_coordinate.s = (clip.x) / tex_width;
+    quad[3].texture_coordinate.t = (clip.y + clip.h) / tex_height;
+}
+
+bool SpriteSheet::generate_data_buffer(SpriteOrigin sprite_origin) {
     if (get_texture_id() != 0 && clips.size() > 0) {
         int total_sprites = clips.size();
         VertexData2D* vertex_data = new VertexData2D[total_sprites*4];
         index_buffers = new GLuint[total_sprites];
         glGenBuffers(1, &vertex_data_buffer);
         glGenBuffers(total_sprites, index_buffers);
-        GLfloat tex_width = get_width();
-        GLfloat tex_height = get_height();
+        origin = sprite_origin;
         GLuint sprite_indicies[4] = {0,0,0,0};
-        //for origin calculation
-        GLfloat vertex_top = 0.f;
-        GLfloat vertex_bottom = 0.f;
-        GLfloat vertex_left = 0.f;
-        GLfloat vertex_right = 0.f;
         for (int i = 0; i < total_sprites; i++) {
             sprite_indicies[0] = i*4+0;
             sprite_indicies[1] = i*4+1;
             sprite_indicies[2] = i*4+2;
             sprite_indicies[3] = i*4+3;
-            //set origin
-            switch (origin) {
-                case SPRITE_ORIGIN_TOP_LEFT:
-                    vertex_top = 0.f;
-                    vertex_bottom = clips[i].h;
-                    vertex_left = 0.f;
-                    vertex_right = clips[i].w;
-                    break;
-                case SPRITE_ORIGIN_TOP_RIGHT:
-                    vertex_top = 0.f;
-                    vertex_bottom = clips[i].h;
-                    vertex_left = -clips[i].w;
-                    vertex_right = 0.f;
-                    break;
-                case SPRITE_ORIGIN_BOTTOM_LEFT:
-                    vertex_top = -clips[i].h;
-                    vertex_bottom = 0.f;
-                    vertex_left = 0.f;
-                    vertex_right = clips[i].w;
-                    break;
-                case SPRITE_ORIGIN_BOTTOM_RIGHT:
-                    vertex_top = -clips[i].h;
-                    vertex_bottom = 0.f;
-                    vertex_left = -clips[i].w;
-                    vertex_right = 0.f;
-                    break;
-                default: //SPRITE_ORIGIN_CENTER
-                    vertex_top = -clips[i].h / 2.f;
-                    vertex_bottom = clips[i].h / 2.f;
-                    vertex_left = -clips[i].w / 2.f;
-                    vertex_right = clips[i].w / 2.f;
-                    break;
-            }
-            vertex_data[sprite_indicies[0]].position.x = vertex_left;
-            vertex_data[sprite_indicies[0]].position.y = vertex_top;
-            vertex_data[sprite_indicies[0]].texture_coordinate.s = (clips[i].x) / tex_width;
-            vertex_data[sprite_indicies[0]].texture_coordinate.t = (clips[i].y) / tex_height;
-            vertex_data[sprite_indicies[1]].position.x = vertex_right;
-            vertex_data[sprite_indicies[1]].position.y = vertex_top;
-            vertex_data[sprite_indicies[1]].texture_coordinate.s = (clips[i].x + clips[i].w) / tex_width;
-            vertex_data[sprite_indicies[1]].texture_coordinate.t = (clips[i].y) / tex_height;
-            vertex_data[sprite_indicies[2]].position.x = vertex_right;
-            vertex_data[sprite_indicies[2]].position.y = vertex_bottom;
-            vertex_data[sprite_indicies[2]].texture_coordinate.s = (clips[i].x + clips[i].w) / tex_width;
-            vertex_data[sprite_indicies[2]].texture_coordinate.t = (clips[i].y + clips[i].h) / tex_height;
-            vertex_data[sprite_indicies[3]].position.x = vertex_left;
-            vertex_data[sprite_indicies[3]].position.y = vertex_bottom;
-            vertex_data[sprite_indicies[3]].texture_coordinate.s = (clips[i].x) / tex_width;
-            vertex_data[sprite_indicies[3]].texture_coordinate.t = (clips[i].y + clips[i].h) / tex_height;
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffers[i]);
+            make_sprite_quad(i, 0.f, 0.f, &vertex_data[i*4]);
+            bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffers[i]);
             glBufferData(GL_ELEMENT_ARRAY_BUFFER, 4*sizeof(GLuint), sprite_indicies, GL_STATIC_DRAW);
         }
-        glBindBuffer(GL_ARRAY_BUFFER, vertex_data_buffer);
+        bind_buffer(GL_ARRAY_BUFFER, vertex_data_buffer);
         glBufferData(GL_ARRAY_BUFFER, total_sprites*4*sizeof(VertexData2D), vertex_data, GL_STATIC_DRAW);
         delete[] vertex_data;
     } else {
@@ -831,10 +1407,14 @@ bool SpriteSheet::generate_data_buffer(SpriteOrigin origin) {
 
 void SpriteSheet::free_sheet() {
     if (vertex_data_buffer != (GLuint)NULL) {
+        forget_buffer(vertex_data_buffer);
         glDeleteBuffers(1, &vertex_data_buffer);
         vertex_data_buffer = (GLuint)NULL;
     }
     if (index_buffers != NULL) {
+        for (size_t i = 0; i < clips.size(); i++) {
+            forget_buffer(index_buffers[i]);
+        }
         glDeleteBuffers(clips.size(), index_buffers);
         delete[] index_buffers;
         index_buffers = NULL;
@@ -849,231 +1429,1313 @@ void SpriteSheet::free_texture() {
 
 void SpriteSheet::render_sprite(int index) {
     if (vertex_data_buffer != (GLuint)NULL) {
-        glBindTexture(GL_TEXTURE_2D, get_texture_id());
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-            glBindBuffer(GL_ARRAY_BUFFER, vertex_data_buffer);
+        bind_texture(get_texture_id());
+        set_client_state(GL_VERTEX_ARRAY, true);
+        set_client_state(GL_TEXTURE_COORD_ARRAY, true);
+            bind_buffer(GL_ARRAY_BUFFER, vertex_data_buffer);
             glTexCoordPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, texture_coordinate));
             glVertexPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, position));
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffers[index]);
+            bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffers[index]);
             glDrawElements(GL_QUADS, 4, GL_UNSIGNED_INT, NULL);
-        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-        glDisableClientState(GL_VERTEX_ARRAY);
+            count_draw_call(4);
     }
 }
 
-
-class Font : private SpriteSheet {
+/* SPRITE BATCHING */
+//collects quads from any number of sprites and draws each run that shares a texture and blend mode with one call.
+//Quads are placed on the CPU, the modelview matrix at flush time applies to the whole batch
+class SpriteBatch {
 public:
-    Font();
-    ~Font();
-    bool load_bitmap(std::string path);
-    void free_font();
-    void render_text(GLfloat x, GLfloat y, std::string text);
-private:
-    GLfloat space;
-    GLfloat line_height;
-    GLfloat new_line;
+    SpriteBatch();
+    virtual ~SpriteBatch();
+    virtual bool init(GLuint max_sprites = 4096);
+    virtual void free_batch();
+    virtual void begin();
+    void draw_sprite(SpriteSheet& sheet, int index, GLfloat x, GLfloat y);
+    void draw_texture(Texture& texture, GLfloat x, GLfloat y, FRect* clip = nullptr);
+    virtual void set_blend(GLenum source, GLenum destination);
+    virtual void end();
+protected:
+    VertexData2D* next_quad(GLuint texture_id);
+    virtual void flush();
+    VertexData2D* vertices;
+    GLuint capacity; //in quads
+    GLuint quad_count;
+    GLuint VBO_id;
+    GLuint batch_texture;
 };
 
-Font::Font() {
-    space = 0.f;
-    line_height = 0.f;
-    new_line = 0.f;
+SpriteBatch::SpriteBatch() {
+    vertices = nullptr;
+    capacity = 0;
+    quad_count = 0;
+    VBO_id = 0;
+    batch_texture = 0;
 }
 
-Font::~Font() {
-    free_font();
+SpriteBatch::~SpriteBatch() {
+    free_batch();
 }
 
-void Font::free_font() {
-    free_texture();
-    space = 0.f;
-    line_height = 0.f;
-    new_line = 0.f;
+bool SpriteBatch::init(GLuint max_sprites) {
+    free_batch();
+    capacity = max_sprites;
+    vertices = new VertexData2D[capacity*4];
+    glGenBuffers(1, &VBO_id);
+    bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+    glBufferData(GL_ARRAY_BUFFER, capacity*4*sizeof(VertexData2D), NULL, GL_STREAM_DRAW);
+    bind_buffer(GL_ARRAY_BUFFER, 0);
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        logGLError(std::cout, "Error creating sprite batch buffer!", error);
+        return false;
+    }
+    return true;
 }
 
-bool Font::load_bitmap(std::string path) {
-    //expects path to bitmap font image with black, white, shades of grey, black is background color
-    //arranged in 16x16 grid in ASCII order
-    bool success = true;
-    const GLuint BLACK_PIXEL = 0xFF000000;
-    free_font();
-    if (load_pixels_from_file(path)) {
-        //cell dimensions
-        GLfloat cell_width = get_image_width() / 16.f;
-        GLfloat cell_height = get_image_height() / 16.f;
-        //letter top and bottom
-        GLuint top = cell_height;
-        GLuint bottom = 0;
-        GLuint A_bottom = 0;
-        //current pixel coordinates
-        int pixel_x = 0;
-        int pixel_y = 0;
-        //base cell offsets
-        int base_offset_x = 0;
-        int base_offset_y = 0;
-        //parsing bitmap
-        GLuint current_char = 0;
-        FRect next_clip = {0.f, 0.f, cell_width, cell_height};
-        //iterate cell rows
-        for (unsigned int rows = 0; rows < 16; rows++) {
-            for (unsigned int columns = 0; columns < 16; columns++) {
-                //parsing cell
-                base_offset_x = cell_width * columns;
-                base_offset_y = cell_height * rows;
-                next_clip.x = cell_width * columns;
-                next_clip.y = cell_height * rows;
-                next_clip.w = cell_width;
-                next_clip.h = cell_height;
-
-                //find left side of character
-                for (int pixel_column = 0; pixel_column < cell_width; pixel_column++) {
-                    for (int pixel_row = 0; pixel_row < cell_height; pixel_row++) {
-                        pixel_x = base_offset_x + pixel_column;
-                        pixel_y = base_offset_y + pixel_row;
-                        if (get_pixel(pixel_x, pixel_y) != BLACK_PIXEL) {
-                            // set sprite x offset
-                            next_clip.x = pixel_x;
-                            // break loop
-                            pixel_column = cell_width;
-                            pixel_row = cell_height;
-                        } 
-                    }
-                }
-                //find right side of character (width)
-                for (int pixel_column_width = cell_width - 1; pixel_column_width >= 0; pixel_column_width--) {
-                    for (int pixel_row_width = 0; pixel_row_width < cell_height; pixel_row_width++) {
-                        pixel_x = base_offset_x + pixel_column_width;
-                        pixel_y = base_offset_y + pixel_row_width;
-                        if (get_pixel(pixel_x, pixel_y) != BLACK_PIXEL) {
-                            // set sprite width
-                            next_clip.w = (pixel_x - next_clip.x) + 1;
-                            // break loop
-                            pixel_column_width = -1;
-                            pixel_row_width = cell_height;
-                        } 
-                    }
-                }
-                //find top side of character
-                for (int pixel_row = 0; pixel_row < cell_height; pixel_row++) {
-                    for (int pixel_column = 0; pixel_column < cell_width; pixel_column++) {
-                        pixel_x = base_offset_x + pixel_column;
-                        pixel_y = base_offset_y + pixel_row;
-                        if (get_pixel(pixel_x, pixel_y) != BLACK_PIXEL) {
-                            // new top found
-                            if (pixel_row < top) {
-                                top = pixel_row;
-                            }
-                            //break loops
-                            pixel_column = cell_width;
-                            pixel_row = cell_height;
-
-                        } 
-                    }
-                }
-                //find bottom side of character (height) and baseline A
-                for (int pixel_row_base = cell_height - 1; pixel_row_base >= 0; pixel_row_base--) {
-                    for (int pixel_column_base = 0; pixel_column_base < cell_width; pixel_column_base++) {
-                        pixel_x = base_offset_x + pixel_column_base;
-                        pixel_y = base_offset_y + pixel_row_base;
-                        if (get_pixel(pixel_x, pixel_y) != BLACK_PIXEL) {
-                            // set baseline
-                            if (current_char == 'A') {
-                                A_bottom = pixel_row_base;
-                            }
-                            // new bottom
-                            if (pixel_row_base > bottom) {
-                                bottom = pixel_row_base;
-                            }
-                            // break loop
-                            pixel_column_base = cell_width;
-                            pixel_row_base = -1;
-                        } 
-                    }
-                }
-                clips.push_back(next_clip);
-                current_char++;
-            }
-        }
-        //trip excess height from top of fonts
-        for (int t = 0; t < 256; t++) {
-            clips[t].y += top;
-            clips[t].h -= top;
-        }
-        //Blend
-        const int RED_BYTE = 1; //FIXME: typo?
-        const int GREEN_BYTE = 1;
-        const int BLUE_BYTE = 2;
-        const int ALPHA_BYTE = 3;
-        const int PIXEL_COUNT = get_width() * get_height();
-        GLuint* pixels = get_pixel_data();
-        for (int i = 0; i < PIXEL_COUNT; i++) {
-            //Get color components
-            GLubyte* colors = (GLubyte*)&pixels[i];
-            //White pixel shaded with transparency
-            colors[ALPHA_BYTE] = colors[RED_BYTE];
-            colors[RED_BYTE] = 0xFF;
-            colors[GREEN_BYTE] = 0xFF;
-            colors[BLUE_BYTE] = 0xFF;
-        }
-        //create texture from pixels
-        if (load_texture_from_pixels()) {
-            if (!generate_data_buffer(SPRITE_ORIGIN_TOP_LEFT)) {
-                printf("Unable to create vertex buffer for bitmap font!\n");
-                success = false;
-            }
-        } else {
-            printf("Unable to create texture from bitmap font pixels!\n");
-            success = false;
-        }
-        //Set wrap
-        glBindTexture(GL_TEXTURE_2D, get_texture_id());
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-        space = cell_width / 2;
-        new_line = A_bottom - top;
-        line_height = bottom - top;
-    } else {
-        printf("Could not load bitmap font image: %s!\n", path.c_str());
-        success = false;
+void SpriteBatch::free_batch() {
+    if (VBO_id != 0) {
+        forget_buffer(VBO_id);
+        glDeleteBuffers(1, &VBO_id);
+        VBO_id = 0;
     }
-    return success;
+    if (vertices != nullptr) {
+        delete[] vertices;
+        vertices = nullptr;
+    }
+    capacity = 0;
+    quad_count = 0;
 }
 
-void Font::render_text(GLfloat x, GLfloat y, std::string text) {
-    if (get_texture_id() != 0) {
-        GLfloat draw_x = x;
-        GLfloat draw_y = y;
-        glTranslatef(x, y, 0.f);
-        glBindTexture(GL_TEXTURE_2D, get_texture_id());
-        glEnableClientState(GL_VERTEX_ARRAY);
-        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-        glBindBuffer(GL_ARRAY_BUFFER, vertex_data_buffer);
+void SpriteBatch::begin() {
+    quad_count = 0;
+    batch_texture = 0;
+}
+
+void SpriteBatch::end() {
+    flush();
+}
+
+//a texture change or a full buffer ends the current run
+VertexData2D* SpriteBatch::next_quad(GLuint texture_id) {
+    if (texture_id != batch_texture || quad_count == capacity) {
+        flush();
+        batch_texture = texture_id;
+    }
+    return &vertices[4*quad_count++];
+}
+
+void SpriteBatch::draw_sprite(SpriteSheet& sheet, int index, GLfloat x, GLfloat y) {
+    if (sheet.get_texture_id() != 0 && vertices != nullptr) {
+        sheet.make_sprite_quad(index, x, y, next_quad(sheet.get_texture_id()));
+    }
+}
+
+void SpriteBatch::draw_texture(Texture& texture, GLfloat x, GLfloat y, FRect* clip) {
+    if (texture.get_texture_id() != 0 && vertices != nullptr) {
+        texture.make_quad(x, y, clip, next_quad(texture.get_texture_id()));
+    }
+}
+
+//compared against the GL state, not a copy of its own: other code may change the blend between two batches
+void SpriteBatch::set_blend(GLenum source, GLenum destination) {
+    if (source != gl_state.blend_source || destination != gl_state.blend_destination) {
+        flush();
+    }
+    blend_func(source, destination);
+}
+
+void SpriteBatch::flush() {
+    if (quad_count == 0) {
+        return;
+    }
+    bind_texture(batch_texture);
+    bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+    //orphan the old storage: the driver hands out fresh memory instead of waiting for draws still reading it
+    glBufferData(GL_ARRAY_BUFFER, capacity*4*sizeof(VertexData2D), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, quad_count*4*sizeof(VertexData2D), vertices);
+    set_client_state(GL_VERTEX_ARRAY, true);
+    set_client_state(GL_TEXTURE_COORD_ARRAY, true);
         glTexCoordPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, texture_coordinate));
         glVertexPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, position));
-        for (int i = 0; i < text.length(); i++) {
-            if (text[i] == ' ') {
-                glTranslatef(space, 0.f, 0.f);
-                draw_x += space;
-            } else if (text[i] == '\n') {
-                glTranslatef(x - draw_x, new_line, 0.f);
-                draw_y += new_line;
-                draw_x += x - draw_x;
-            } else {
-                GLuint ascii = (unsigned char)text[i];
-                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffers[ascii]);
-                glDrawElements(GL_QUADS, 4, GL_UNSIGNED_INT, NULL);
-                glTranslatef(clips[ascii].w, 0.f, 0.f);
-                draw_x += clips[ascii].w;
-            }
-        }
-        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-        glDisableClientState(GL_VERTEX_ARRAY);
-    }
+        glDrawArrays(GL_QUADS, 0, quad_count*4);
+        count_draw_call(quad_count*4);
+    quad_count = 0;
 }
 
 
+/* COMMAND LISTS */
+//a sprite batch that records instead of drawing: quads are placed and uploaded once at end(), then replay()
+//issues the recorded draws and state as often as needed, e.g. once per viewport
+enum CommandType {
+    COMMAND_DRAW_QUADS, //argument is the texture, first and count are vertices
+    COMMAND_COLOR,      //argument indexes colors
+    COMMAND_TRANSFORM,  //argument indexes transforms, loaded as the modelview
+    COMMAND_BLEND       //first is the source factor, count the destination
+};
+
+struct Command {
+    CommandType type;
+    GLuint argument;
+    GLuint first;
+    GLuint count;
+};
+
+class CommandList : public SpriteBatch {
+public:
+    CommandList();
+    void free_batch();
+    void begin();
+    void end();
+    void set_blend(GLenum source, GLenum destination);
+    void set_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.f);
+    void set_transform(const Matrix4& transform);
+    void replay();
+    void replay(GLint x, GLint y, GLsizei width, GLsizei height, const Matrix4& projection);
+    int get_command_count();
+protected:
+    void flush();
+    std::vector<Command> commands;
+    std::vector<Matrix4> transforms;
+    std::vector<GLfloat> colors;
+    GLuint run_start; //first quad not yet in a draw command
+    GLenum blend_source; //last recorded blend
+    GLenum blend_destination;
+};
+
+CommandList::CommandList() {
+    run_start = 0;
+    blend_source = GL_SRC_ALPHA;
+    blend_destination = GL_ONE_MINUS_SRC_ALPHA;
+}
+
+void CommandList::free_batch() {
+    SpriteBatch::free_batch();
+    commands.clear();
+    transforms.clear();
+    colors.clear();
+    run_start = 0;
+}
+
+//every recording starts with the default blend, so a replay doesn't inherit whatever blend the GL was left in
+void CommandList::begin() {
+    SpriteBatch::begin();
+    commands.clear();
+    transforms.clear();
+    colors.clear();
+    run_start = 0;
+    blend_source = GL_SRC_ALPHA;
+    blend_destination = GL_ONE_MINUS_SRC_ALPHA;
+    Command blend = {COMMAND_BLEND, 0, blend_source, blend_destination};
+    commands.push_back(blend);
+}
+
+//closes the current run into a draw command. The list grows instead of drawing when it fills up
+void CommandList::flush() {
+    if (quad_count > run_start) {
+        Command draw = {COMMAND_DRAW_QUADS, batch_texture, run_start * 4, (quad_count - run_start) * 4};
+        commands.push_back(draw);
+        run_start = quad_count;
+    }
+    if (quad_count == capacity && capacity > 0) {
+        VertexData2D* grown = new VertexData2D[capacity * 8];
+        memcpy(grown, vertices, capacity * 4 * sizeof(VertexData2D));
+        delete[] vertices;
+        vertices = grown;
+        capacity *= 2;
+    }
+}
+
+void CommandList::end() {
+    flush();
+    if (quad_count == 0 || VBO_id == 0) {
+        return;
+    }
+    bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+    glBufferData(GL_ARRAY_BUFFER, capacity*4*sizeof(VertexData2D), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, quad_count*4*sizeof(VertexData2D), vertices);
+}
+
+void CommandList::set_blend(GLenum source, GLenum destination) {
+    if (source != blend_source || destination != blend_destination) {
+        flush();
+        blend_source = source;
+        blend_destination = destination;
+        Command blend = {COMMAND_BLEND, 0, source, destination};
+        commands.push_back(blend);
+    }
+}
+
+void CommandList::set_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+    flush();
+    Command color = {COMMAND_COLOR, (GLuint)colors.size(), 0, 0};
+    commands.push_back(color);
+    colors.push_back(r);
+    colors.push_back(g);
+    colors.push_back(b);
+    colors.push_back(a);
+}
+
+void CommandList::set_transform(const Matrix4& transform) {
+    flush();
+    Command load = {COMMAND_TRANSFORM, (GLuint)transforms.size(), 0, 0};
+    commands.push_back(load);
+    transforms.push_back(transform);
+}
+
+//the modelview when this is called applies until the first recorded transform, and is restored after
+void CommandList::replay() {
+    if (commands.empty()) {
+        return;
+    }
+    glPushMatrix();
+    bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+    set_client_state(GL_VERTEX_ARRAY, true);
+    set_client_state(GL_TEXTURE_COORD_ARRAY, true);
+    glTexCoordPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, texture_coordinate));
+    glVertexPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, position));
+    for (size_t i = 0; i < commands.size(); i++) {
+        const Command& command = commands[i];
+        switch (command.type) {
+            case COMMAND_DRAW_QUADS:
+                bind_texture(command.argument);
+                glDrawArrays(GL_QUADS, command.first, command.count);
+                count_draw_call(command.count);
+                break;
+            case COMMAND_COLOR:
+                glColor4fv(&colors[command.argument]);
+                break;
+            case COMMAND_TRANSFORM:
+                glLoadMatrixf(transforms[command.argument].m);
+                break;
+            case COMMAND_BLEND:
+                blend_func(command.first, command.count);
+                break;
+        }
+    }
+    glPopMatrix();
+}
+
+//replays into a viewport with its own projection. The viewport is left set, the projection is restored
+void CommandList::replay(GLint x, GLint y, GLsizei width, GLsizei height, const Matrix4& projection) {
+    glViewport(x, y, width, height);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadMatrixf(projection.m);
+    glMatrixMode(GL_MODELVIEW);
+    replay();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+int CommandList::get_command_count() {
+    return commands.size();
+}
+
+/* TEXTURE ATLAS */
+//skyline bottom-left packing: the top edge of everything placed so far is a list of horizontal segments,
+//and each rect goes wherever its top ends up lowest
+class SkylinePacker {
+public:
+    void init(GLuint width, GLuint height);
+    bool insert(GLuint w, GLuint h, GLuint& x, GLuint& y);
+    GLuint get_used_height();
+private:
+    struct Segment {
+        GLuint x;
+        GLuint y;
+        GLuint w;
+    };
+    bool fit(size_t index, GLuint w, GLuint h, GLuint& y);
+    std::vector<Segment> skyline;
+    GLuint width;
+    GLuint height;
+    GLuint used_height;
+};
+
+void SkylinePacker::init(GLuint w, GLuint h) {
+    width = w;
+    height = h;
+    used_height = 0;
+    skyline.clear();
+    Segment floor = {0, 0, w};
+    skyline.push_back(floor);
+}
+
+//lowest y a w x h rect can sit at with its left edge on segment index
+bool SkylinePacker::fit(size_t index, GLuint w, GLuint h, GLuint& y) {
+    if (skyline[index].x + w > width) {
+        return false;
+    }
+    y = 0;
+    GLuint covered = 0;
+    for (size_t i = index; covered < w; i++) {
+        y = std::max(y, skyline[i].y);
+        covered += skyline[i].w;
+    }
+    return y + h <= height;
+}
+
+bool SkylinePacker::insert(GLuint w, GLuint h, GLuint& x, GLuint& y) {
+    size_t best = skyline.size();
+    GLuint best_top = height + 1;
+    GLuint best_width = 0;
+    for (size_t i = 0; i < skyline.size(); i++) {
+        GLuint fit_y;
+        if (fit(i, w, h, fit_y) && (fit_y + h < best_top || (fit_y + h == best_top && skyline[i].w < best_width))) {
+            best = i;
+            best_top = fit_y + h;
+            best_width = skyline[i].w;
+            y = fit_y;
+        }
+    }
+    if (best == skyline.size()) {
+        return false;
+    }
+    x = skyline[best].x;
+    //the new segment covers the ones it sits on, the last of those may stick out past it
+    Segment top = {x, best_top, w};
+    skyline.insert(skyline.begin() + best, top);
+    size_t i = best + 1;
+    while (i < skyline.size() && skyline[i].x < x + w) {
+        GLuint end = skyline[i].x + skyline[i].w;
+        if (end <= x + w) {
+            skyline.erase(skyline.begin() + i);
+        } else {
+            skyline[i].w = end - (x + w);
+            skyline[i].x = x + w;
+            break;
+        }
+    }
+    //merge neighbours at the same height
+    for (size_t j = 0; j + 1 < skyline.size();) {
+        if (skyline[j].y == skyline[j+1].y) {
+            skyline[j].w += skyline[j+1].w;
+            skyline.erase(skyline.begin() + j + 1);
+        } else {
+            j++;
+        }
+    }
+    used_height = std::max(used_height, best_top);
+    return true;
+}
+
+GLuint SkylinePacker::get_used_height() {
+    return used_height;
+}
+
+//where an image ended up: the atlas page and its clip on that page
+struct AtlasEntry {
+    std::string path;
+    int page;
+    FRect clip;
+};
+
+//packs images into a few large pages at load time. The pages are sprite sheets, so an entry's clip works with
+//Texture::render, SpriteSheet::add_sprite_clip and SpriteBatch, and images sharing a page share one texture bind
+class TextureAtlas {
+public:
+    TextureAtlas();
+    ~TextureAtlas();
+    bool build(const std::vector<std::string>& paths, GLuint page_size = 2048, GLuint padding = 1);
+    void free_atlas();
+    AtlasEntry* find(const std::string& path);
+    SpriteSheet& get_page(int page);
+    int get_page_count();
+private:
+    std::vector<AtlasEntry> entries;
+    std::vector<SpriteSheet*> pages;
+};
+
+TextureAtlas::TextureAtlas() {}
+
+TextureAtlas::~TextureAtlas() {
+    free_atlas();
+}
+
+void TextureAtlas::free_atlas() {
+    for (size_t i = 0; i < pages.size(); i++) {
+        delete pages[i];
+    }
+    pages.clear();
+    entries.clear();
+}
+
+AtlasEntry* TextureAtlas::find(const std::string& path) {
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].path == path) {
+            return &entries[i];
+        }
+    }
+    return nullptr;
+}
+
+SpriteSheet& TextureAtlas::get_page(int page) {
+    return *pages[page];
+}
+
+int TextureAtlas::get_page_count() {
+    return pages.size();
+}
+
+bool TextureAtlas::build(const std::vector<std::string>& paths, GLuint page_size, GLuint padding) {
+    free_atlas();
+    //load everything first, packing tallest first leaves the flattest skyline
+    std::vector<SDL_Surface*> images;
+    std::vector<size_t> order;
+    for (size_t i = 0; i < paths.size(); i++) {
+        SDL_Surface* lsurface = IMG_Load(paths[i].c_str());
+        if (lsurface == nullptr) {
+            logSDLError(std::cout, "IMG_Load");
+            for (size_t j = 0; j < images.size(); j++) SDL_FreeSurface(images[j]);
+            return false;
+        }
+        SDL_Surface* csurface = SDL_ConvertSurfaceFormat(lsurface, SDL_PIXELFORMAT_RGBA32, 0);
+        SDL_FreeSurface(lsurface);
+        if (csurface == nullptr) {
+            logSDLError(std::cout, "SDL_ConvertSurfaceFormat");
+            for (size_t j = 0; j < images.size(); j++) SDL_FreeSurface(images[j]);
+            return false;
+        }
+        images.push_back(csurface);
+        order.push_back(i);
+    }
+    for (size_t i = 1; i < order.size(); i++) {
+        for (size_t j = i; j > 0 && images[order[j]]->h > images[order[j-1]]->h; j--) {
+            std::swap(order[j], order[j-1]);
+        }
+    }
+
+    bool success = true;
+    std::vector<SkylinePacker> packers;
+    std::vector<GLuint*> page_pixels;
+    entries.resize(paths.size());
+    GLuint image_area = 0;
+    GLuint separate_area = 0; //what the images would take as their own power of two textures
+    for (size_t k = 0; k < order.size() && success; k++) {
+        SDL_Surface* image = images[order[k]];
+        GLuint w = image->w + 2*padding;
+        GLuint h = image->h + 2*padding;
+        GLuint x = 0, y = 0;
+        size_t page = 0;
+        while (page < packers.size() && !packers[page].insert(w, h, x, y)) {
+            page++;
+        }
+        if (page == packers.size()) {
+            packers.push_back(SkylinePacker());
+            packers.back().init(page_size, page_size);
+            page_pixels.push_back(new GLuint[page_size * page_size]());
+            if (!packers.back().insert(w, h, x, y)) {
+                printf("%s is too big for a %dx%d atlas page!\n", paths[order[k]].c_str(), page_size, page_size);
+                success = false;
+                break;
+            }
+        }
+        //copy the image in, the padding repeats its edge pixels so filtering never pulls in a neighbour
+        GLuint* pixels = (GLuint*)image->pixels;
+        GLuint pitch = image->pitch / 4;
+        for (GLuint py = 0; py < h; py++) {
+            GLuint sy = std::min(std::max((int)py - (int)padding, 0), image->h - 1);
+            for (GLuint px = 0; px < w; px++) {
+                GLuint sx = std::min(std::max((int)px - (int)padding, 0), image->w - 1);
+                page_pixels[page][(y + py) * page_size + x + px] = pixels[sy * pitch + sx];
+            }
+        }
+        AtlasEntry& entry = entries[order[k]];
+        entry.path = paths[order[k]];
+        entry.page = page;
+        entry.clip.x = x + padding;
+        entry.clip.y = y + padding;
+        entry.clip.w = image->w;
+        entry.clip.h = image->h;
+        image_area += image->w * image->h;
+        separate_area += Texture::storage_size(image->w) * Texture::storage_size(image->h);
+    }
+
+    GLuint page_area = 0;
+    for (size_t page = 0; page < page_pixels.size(); page++) {
+        if (success) {
+            //pages are square while packing, the last rows nothing reached are cut off
+            GLuint used_height = packers[page].get_used_height();
+            GLuint page_height = Texture::storage_size(used_height);
+            pages.push_back(new SpriteSheet());
+            if (!pages.back()->load_texture_from_rgba_pixels(page_pixels[page], page_size, used_height, page_size, page_height)) {
+                success = false;
+            }
+            page_area += page_size * page_height;
+        }
+        delete[] page_pixels[page];
+    }
+    for (size_t i = 0; i < images.size(); i++) {
+        SDL_FreeSurface(images[i]);
+    }
+    if (!success) {
+        free_atlas();
+        return false;
+    }
+    printf("Atlas: %d images in %d page(s), %.1f%% of the page area used, %.1f KB of textures instead of %.1f KB, "
+           "%d texture binds instead of %d to draw each once\n",
+           (int)paths.size(), (int)pages.size(), 100.f * image_area / page_area, page_area * 4 / 1024.f,
+           separate_area * 4 / 1024.f, (int)pages.size(), (int)paths.size());
+    return true;
+}
+
+/* RENDER LAYERS */
+//a layer of static drawing kept in a framebuffer object. It's drawn again only after mark_dirty, every other
+//frame it costs one textured quad
+class RenderLayer : private Texture {
+public:
+    RenderLayer();
+    ~RenderLayer();
+    bool init(const std::string& name, GLuint width, GLuint height);
+    void free_layer();
+    void mark_dirty();
+    bool begin_update();
+    void end_update();
+    void render(GLfloat x, GLfloat y);
+    Matrix4 get_projection();
+    void print_stats();
+    int get_hits();
+    int get_misses();
+private:
+    void save_blend(GLint* blend);
+    void restore_blend(const GLint* blend);
+    std::string name;
+    GLuint FBO_id;
+    bool dirty;
+    int hits;
+    int misses;
+    GLint saved_viewport[4];
+    GLint saved_framebuffer;
+    GLfloat saved_clear_color[4];
+    GLint saved_blend[4]; //source and destination for color, then for alpha
+};
+
+RenderLayer::RenderLayer() {
+    FBO_id = 0;
+    dirty = true;
+    hits = 0;
+    misses = 0;
+    saved_framebuffer = 0;
+}
+
+RenderLayer::~RenderLayer() {
+    free_layer();
+}
+
+bool RenderLayer::init(const std::string& layer_name, GLuint width, GLuint height) {
+    free_layer();
+    name = layer_name;
+    if (!(GLEW_VERSION_3_0 || GLEW_ARB_framebuffer_object)) {
+        printf("Framebuffer objects not supported, layer %s can't be cached!\n", name.c_str());
+        return false;
+    }
+    if (!load_texture_from_rgba_pixels(nullptr, width, height, storage_size(width), storage_size(height))) {
+        return false;
+    }
+    glGenFramebuffers(1, &FBO_id);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO_id);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, get_texture_id(), 0);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+        printf("Layer %s framebuffer incomplete: 0x%x!\n", name.c_str(), status);
+        free_layer();
+        return false;
+    }
+    dirty = true;
+    return true;
+}
+
+void RenderLayer::free_layer() {
+    if (FBO_id != 0) {
+        glDeleteFramebuffers(1, &FBO_id);
+        FBO_id = 0;
+    }
+    free_texture();
+    dirty = true;
+    hits = 0;
+    misses = 0;
+}
+
+void RenderLayer::mark_dirty() {
+    dirty = true;
+}
+
+//true when the layer has to be drawn again: the layer is bound as the target with a clear, transparent
+//canvas and screen style projection, draw it then call end_update. False means the cached pixels are good
+bool RenderLayer::begin_update() {
+    if (!dirty || FBO_id == 0) {
+        hits++;
+        return false;
+    }
+    misses++;
+    glGetIntegerv(GL_VIEWPORT, saved_viewport);
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &saved_framebuffer);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, saved_clear_color);
+    save_blend(saved_blend);
+    glBindFramebuffer(GL_FRAMEBUFFER, FBO_id);
+    glViewport(0, 0, image_width, image_height);
+    glClearColor(0.f, 0.f, 0.f, 0.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadMatrixf(get_projection().m);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    //premultiplied into the layer, so the alpha it stores is the coverage and not alpha squared
+    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    gl_state.blend_source = UNKNOWN_BINDING;
+    gl_state.blend_destination = UNKNOWN_BINDING;
+    return true;
+}
+
+void RenderLayer::end_update() {
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopMatrix();
+    glBindFramebuffer(GL_FRAMEBUFFER, saved_framebuffer);
+    glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2], saved_viewport[3]);
+    glClearColor(saved_clear_color[0], saved_clear_color[1], saved_clear_color[2], saved_clear_color[3]);
+    restore_blend(saved_blend);
+    dirty = false;
+}
+
+//the state cache knows the blend unless something set it with glBlendFuncSeparate, only then is it read back
+void RenderLayer::save_blend(GLint* blend) {
+    if (gl_state.blend_source != UNKNOWN_BINDING && gl_state.blend_destination != UNKNOWN_BINDING) {
+        blend[0] = blend[2] = gl_state.blend_source;
+        blend[1] = blend[3] = gl_state.blend_destination;
+        return;
+    }
+    glGetIntegerv(GL_BLEND_SRC_RGB, &blend[0]);
+    glGetIntegerv(GL_BLEND_DST_RGB, &blend[1]);
+    glGetIntegerv(GL_BLEND_SRC_ALPHA, &blend[2]);
+    glGetIntegerv(GL_BLEND_DST_ALPHA, &blend[3]);
+}
+
+void RenderLayer::restore_blend(const GLint* blend) {
+    if (blend[0] == blend[2] && blend[1] == blend[3]) {
+        blend_func(blend[0], blend[1]);
+        return;
+    }
+    glBlendFuncSeparate(blend[0], blend[1], blend[2], blend[3]);
+    gl_state.blend_source = UNKNOWN_BINDING;
+    gl_state.blend_destination = UNKNOWN_BINDING;
+}
+
+//bottom up like the framebuffer, so row 0 of the texture is the top of the layer the way Texture draws it
+Matrix4 RenderLayer::get_projection() {
+    return ortho_matrix(0.f, image_width, 0.f, image_height, 1.f, -1.f);
+}
+
+void RenderLayer::render(GLfloat x, GLfloat y) {
+    if (FBO_id == 0) {
+        return;
+    }
+    GLint blend[4];
+    save_blend(blend);
+    glColor4f(1.f, 1.f, 1.f, 1.f);
+    blend_func(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    Texture::render(x, y);
+    restore_blend(blend);
+}
+
+void RenderLayer::print_stats() {
+    int frames = hits + misses;
+    printf("Layer %s: %d hits, %d misses (%.1f%% cached)\n", name.c_str(), hits, misses,
+           frames > 0 ? 100.f * hits / frames : 0.f);
+}
+
+int RenderLayer::get_hits() {
+    return hits;
+}
+
+int RenderLayer::get_misses() {
+    return misses;
+}
+
+//a string laid out at one position, kept in its own vertex buffer
+struct TextMesh {
+    std::string text;
+    GLfloat x;
+    GLfloat y;
+    GLuint VBO_id;
+    GLsizei vertex_count;
+    unsigned int last_used;
+};
+
+//strings drawn every frame stay cached, the least recently drawn one makes room for a new string
+const size_t TEXT_MESH_CACHE_SIZE = 32;
+
+class Font : private SpriteSheet {
+public:
+    Font();
+    ~Font();
+    bool load_bitmap(std::string path);
+    void free_font();
+    void render_text(GLfloat x, GLfloat y, std::string text);
+    void render_text(TexturedPolygonProgram2D& program, GLfloat x, GLfloat y, std::string text);
+private:
+    TextMesh& get_text_mesh(GLfloat x, GLfloat y, const std::string& text);
+    void build_text_mesh(TextMesh& mesh);
+    void free_text_meshes();
+    void parse_bitmap();
+    bool load_cache(const std::string& cache_path, Uint64 image_hash);
+    void save_cache(const std::string& cache_path, Uint64 image_hash);
+    GLfloat space;
+    GLfloat line_height;
+    GLfloat new_line;
+    std::vector<TextMesh> text_meshes;
+    std::vector<VertexData2D> layout; //scratch for building meshes
+    unsigned int text_mesh_clock;
+};
+
+Font::Font() {
+    space = 0.f;
+    line_height = 0.f;
+    new_line = 0.f;
+    text_mesh_clock = 0;
+}
+
+Font::~Font() {
+    free_font();
+}
+
+void Font::free_font() {
+    free_text_meshes();
+    free_texture();
+    space = 0.f;
+    line_height = 0.f;
+    new_line = 0.f;
+}
+
+//FNV-1a, pass the last hash back in to keep hashing across several buffers
+const Uint64 FNV_OFFSET_BASIS = 14695981039346656037ULL;
+
+Uint64 hash_bytes(const void* bytes, size_t length, Uint64 hash = FNV_OFFSET_BASIS) {
+    const unsigned char* data = (const unsigned char*)bytes;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool hash_file(const std::string& path, Uint64& hash) {
+    std::ifstream in(path.c_str(), std::ifstream::in | std::ifstream::binary);
+    if (!in) {
+        return false;
+    }
+    hash = FNV_OFFSET_BASIS;
+    char buffer[4096];
+    while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0) {
+        hash = hash_bytes(buffer, in.gcount(), hash);
+    }
+    return true;
+}
+
+//baked font: this header, the clips, then the blended texture pixels
+struct FontCacheHeader {
+    char magic[4];
+    Uint64 image_hash;
+    GLuint image_width;
+    GLuint image_height;
+    GLuint texture_width;
+    GLuint texture_height;
+    GLenum pixel_mode;
+    GLfloat space;
+    GLfloat line_height;
+    GLfloat new_line;
+    GLuint clip_count;
+};
+
+const char FONT_CACHE_MAGIC[4] = {'T', 'G', 'F', '1'};
+
+bool Font::load_bitmap(std::string path) {
+    //expects path to bitmap font image with black, white, shades of grey, black is background color
+    //arranged in 16x16 grid in ASCII order
+    bool success = true;
+    free_font();
+    //the parsed metrics and pixels are baked next to the image, keyed on its contents
+    std::string cache_path = path + ".cache";
+    Uint64 image_hash = 0;
+    bool hashed = hash_file(path, image_hash);
+    if (hashed && load_cache(cache_path, image_hash)) {
+        file_path = path;
+    } else if (load_pixels_from_file(path) && get_pixel_data() != nullptr) {
+        parse_bitmap();
+        if (hashed) {
+            save_cache(cache_path, image_hash);
+        }
+    } else {
+        printf("Could not load bitmap font image: %s!\n", path.c_str());
+        return false;
+    }
+    //create texture from pixels
+    if (load_texture_from_pixels()) {
+        if (!generate_data_buffer(SPRITE_ORIGIN_TOP_LEFT)) {
+            printf("Unable to create vertex buffer for bitmap font!\n");
+            success = false;
+        }
+    } else {
+        printf("Unable to create texture from bitmap font pixels!\n");
+        success = false;
+    }
+    //Set wrap
+    bind_texture(get_texture_id());
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    return success;
+}
+
+void Font::parse_bitmap() {
+    const GLuint BLACK_PIXEL = 0xFF000000;
+    //cell dimensions
+    GLfloat cell_width = get_image_width() / 16.f;
+    GLfloat cell_height = get_image_height() / 16.f;
+    //letter top and bottom
+    GLuint top = cell_height;
+    GLuint bottom = 0;
+    GLuint A_bottom = 0;
+    GLuint* pixels = get_pixel_data();
+    //which rows and columns of the current cell have any ink
+    std::vector<char> row_mask(cell_height + 1);
+    std::vector<char> column_mask(cell_width + 1);
+    GLuint current_char = 0;
+    //iterate cell rows
+    for (unsigned int rows = 0; rows < 16; rows++) {
+        for (unsigned int columns = 0; columns < 16; columns++) {
+            int base_offset_x = cell_width * columns;
+            int base_offset_y = cell_height * rows;
+            FRect next_clip = {cell_width * columns, cell_height * rows, cell_width, cell_height};
+            //one pass over the cell fills both masks
+            std::fill(row_mask.begin(), row_mask.end(), 0);
+            std::fill(column_mask.begin(), column_mask.end(), 0);
+            for (int pixel_row = 0; pixel_row < cell_height; pixel_row++) {
+                GLuint* row = pixels + (base_offset_y + pixel_row) * get_width() + base_offset_x;
+                for (int pixel_column = 0; pixel_column < cell_width; pixel_column++) {
+                    if (row[pixel_column] != BLACK_PIXEL) {
+                        row_mask[pixel_row] = 1;
+                        column_mask[pixel_column] = 1;
+                    }
+                }
+            }
+            //the extents are the first and last set entries, an empty cell keeps the whole cell as its clip
+            int left = 0;
+            while (left < cell_width && !column_mask[left]) left++;
+            if (left < cell_width) {
+                int right = cell_width - 1;
+                while (!column_mask[right]) right--;
+                next_clip.x = base_offset_x + left;
+                next_clip.w = right - left + 1;
+                int first_row = 0;
+                while (!row_mask[first_row]) first_row++;
+                int last_row = cell_height - 1;
+                while (!row_mask[last_row]) last_row--;
+                top = std::min(top, (GLuint)first_row);
+                bottom = std::max(bottom, (GLuint)last_row);
+                // set baseline
+                if (current_char == 'A') {
+                    A_bottom = last_row;
+                }
+            }
+            clips.push_back(next_clip);
+            current_char++;
+        }
+    }
+    //trip excess height from top of fonts
+    for (int t = 0; t < 256; t++) {
+        clips[t].y += top;
+        clips[t].h -= top;
+    }
+    //Blend
+    const int RED_BYTE = 1; //FIXME: typo?
+    const int GREEN_BYTE = 1;
+    const int BLUE_BYTE = 2;
+    const int ALPHA_BYTE = 3;
+    const int PIXEL_COUNT = get_width() * get_height();
+    for (int i = 0; i < PIXEL_COUNT; i++) {
+        //Get color components
+        GLubyte* colors = (GLubyte*)&pixels[i];
+        //White pixel shaded with transparency
+        colors[ALPHA_BYTE] = colors[RED_BYTE];
+        colors[RED_BYTE] = 0xFF;
+        colors[GREEN_BYTE] = 0xFF;
+        colors[BLUE_BYTE] = 0xFF;
+    }
+    space = cell_width / 2;
+    new_line = A_bottom - top;
+    line_height = bottom - top;
+}
+
+bool Font::load_cache(const std::string& cache_path, Uint64 image_hash) {
+    std::ifstream in(cache_path.c_str(), std::ifstream::in | std::ifstream::binary);
+    if (!in) {
+        return false;
+    }
+    FontCacheHeader header;
+    if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, FONT_CACHE_MAGIC, 4) != 0 ||
+        header.image_hash != image_hash || header.clip_count != 256) {
+        return false;
+    }
+    //the sizes come from the file, they must describe a texture this GL can hold before anything is allocated
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (header.image_width == 0 || header.image_height == 0 || header.texture_width < header.image_width ||
+        header.texture_height < header.image_height || header.texture_width > (GLuint)max_size || header.texture_height > (GLuint)max_size) {
+        return false;
+    }
+    clips.resize(header.clip_count);
+    size_t size = (size_t)header.texture_width * header.texture_height;
+    raw_pixels = new GLuint[size];
+    if (!in.read((char*)&clips[0], header.clip_count * sizeof(FRect)) || !in.read((char*)raw_pixels, size * sizeof(GLuint))) {
+        //truncated, parse the image instead
+        free_texture();
+        return false;
+    }
+    image_width = header.image_width;
+    image_height = header.image_height;
+    texture_width = header.texture_width;
+    texture_height = header.texture_height;
+    pixel_mode = header.pixel_mode;
+    space = header.space;
+    line_height = header.line_height;
+    new_line = header.new_line;
+    return true;
+}
+
+void Font::save_cache(const std::string& cache_path, Uint64 image_hash) {
+    FontCacheHeader header;
+    memcpy(header.magic, FONT_CACHE_MAGIC, 4);
+    header.image_hash = image_hash;
+    header.image_width = image_width;
+    header.image_height = image_height;
+    header.texture_width = texture_width;
+    header.texture_height = texture_height;
+    header.pixel_mode = pixel_mode;
+    header.space = space;
+    header.line_height = line_height;
+    header.new_line = new_line;
+    header.clip_count = clips.size();
+    std::ofstream out(cache_path.c_str(), std::ofstream::out | std::ofstream::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)&clips[0], clips.size() * sizeof(FRect));
+    out.write((const char*)raw_pixels, texture_width * texture_height * sizeof(GLuint));
+    if (!out) {
+        printf("Unable to write font cache %s!\n", cache_path.c_str());
+    }
+}
+
+void Font::free_text_meshes() {
+    for (size_t i = 0; i < text_meshes.size(); i++) {
+        forget_buffer(text_meshes[i].VBO_id);
+        glDeleteBuffers(1, &text_meshes[i].VBO_id);
+    }
+    text_meshes.clear();
+    text_mesh_clock = 0;
+}
+
+TextMesh& Font::get_text_mesh(GLfloat x, GLfloat y, const std::string& text) {
+    text_mesh_clock++;
+    size_t oldest = 0;
+    for (size_t i = 0; i < text_meshes.size(); i++) {
+        TextMesh& mesh = text_meshes[i];
+        if (mesh.x == x && mesh.y == y && mesh.text == text) {
+            mesh.last_used = text_mesh_clock;
+            return mesh;
+        }
+        if (mesh.last_used < text_meshes[oldest].last_used) {
+            oldest = i;
+        }
+    }
+    if (text_meshes.size() < TEXT_MESH_CACHE_SIZE) {
+        TextMesh mesh;
+        glGenBuffers(1, &mesh.VBO_id);
+        text_meshes.push_back(mesh);
+        oldest = text_meshes.size() - 1;
+    }
+    //reuse the buffer of the evicted string
+    TextMesh& mesh = text_meshes[oldest];
+    mesh.text = text;
+    mesh.x = x;
+    mesh.y = y;
+    mesh.last_used = text_mesh_clock;
+    build_text_mesh(mesh);
+    return mesh;
+}
+
+void Font::build_text_mesh(TextMesh& mesh) {
+    GLfloat draw_x = mesh.x;
+    GLfloat draw_y = mesh.y;
+    layout.clear();
+    for (size_t i = 0; i < mesh.text.length(); i++) {
+        if (mesh.text[i] == ' ') {
+            draw_x += space;
+        } else if (mesh.text[i] == '\n') {
+            draw_y += new_line;
+            draw_x = mesh.x;
+        } else {
+            GLuint ascii = (unsigned char)mesh.text[i];
+            layout.resize(layout.size() + 4);
+            make_sprite_quad(ascii, draw_x, draw_y, &layout[layout.size() - 4]);
+            draw_x += clips[ascii].w;
+        }
+    }
+    mesh.vertex_count = layout.size();
+    bind_buffer(GL_ARRAY_BUFFER, mesh.VBO_id);
+    glBufferData(GL_ARRAY_BUFFER, layout.size()*sizeof(VertexData2D), layout.data(), GL_STATIC_DRAW);
+    bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+//the whole string is one draw call from its cached mesh, only a string not drawn recently is laid out again
+void Font::render_text(GLfloat x, GLfloat y, std::string text) {
+    if (get_texture_id() != 0) {
+        TextMesh& mesh = get_text_mesh(x, y, text);
+        if (mesh.vertex_count == 0) {
+            return;
+        }
+        bind_texture(get_texture_id());
+        set_client_state(GL_VERTEX_ARRAY, true);
+        set_client_state(GL_TEXTURE_COORD_ARRAY, true);
+        bind_buffer(GL_ARRAY_BUFFER, mesh.VBO_id);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, texture_coordinate));
+        glVertexPointer(2, GL_FLOAT, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, position));
+        glDrawArrays(GL_QUADS, 0, mesh.vertex_count);
+        count_draw_call(mesh.vertex_count);
+    }
+}
+
+
+/* PROFILER */
+//named zones timed on the CPU and, with timer queries, on the GPU. Each zone has a ring of GL_TIME_ELAPSED
+//queries, one per frame in flight. Results are only read once the GPU says they're in, so the CPU never waits on them
+const int PROFILER_QUERY_FRAMES = 4;
+
+struct ProfileZone {
+    std::string name;
+    int depth;
+    GLuint queries[PROFILER_QUERY_FRAMES];
+    bool issued[PROFILER_QUERY_FRAMES];
+    Uint64 cpu_start;
+    bool timing_gpu;
+    //last result and running totals for the dump
+    float cpu_ms;
+    float gpu_ms;
+    double cpu_total_ms;
+    double gpu_total_ms;
+    float cpu_max_ms;
+    float gpu_max_ms;
+    int cpu_samples;
+    int gpu_samples;
+    int gpu_skipped; //frames the zone's query was still in flight from PROFILER_QUERY_FRAMES frames back
+};
+
+class Profiler {
+public:
+    Profiler();
+    ~Profiler();
+    bool init();
+    void free_profiler();
+    void begin_frame();
+    void end_frame();
+    void begin_zone(const std::string& name);
+    void end_zone();
+    void render_overlay(Font& font, GLfloat x, GLfloat y);
+    bool dump(const std::string& path);
+    bool has_gpu_timing();
+private:
+    ProfileZone& get_zone(const std::string& name);
+    std::vector<ProfileZone> zones;
+    std::vector<int> open_zones;
+    bool gpu_timing;
+    bool gpu_query_active; //time elapsed queries don't nest, inner zones are CPU only
+    int frame;
+};
+
+//times the enclosing block
+struct ProfileScope {
+    ProfileScope(Profiler& profiler, const std::string& name) : profiler(profiler) { profiler.begin_zone(name); }
+    ~ProfileScope() { profiler.end_zone(); }
+    Profiler& profiler;
+};
+
+Profiler::Profiler() {
+    gpu_timing = false;
+    gpu_query_active = false;
+    frame = 0;
+}
+
+Profiler::~Profiler() {
+    free_profiler();
+}
+
+bool Profiler::init() {
+    free_profiler();
+    gpu_timing = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+    if (!gpu_timing) {
+        printf("Timer queries not supported, profiling the CPU only\n");
+    }
+    return gpu_timing;
+}
+
+void Profiler::free_profiler() {
+    for (size_t i = 0; i < zones.size(); i++) {
+        if (zones[i].queries[0] != 0) {
+            glDeleteQueries(PROFILER_QUERY_FRAMES, zones[i].queries);
+        }
+    }
+    zones.clear();
+    open_zones.clear();
+    gpu_query_active = false;
+    frame = 0;
+}
+
+bool Profiler::has_gpu_timing() {
+    return gpu_timing;
+}
+
+ProfileZone& Profiler::get_zone(const std::string& name) {
+    for (size_t i = 0; i < zones.size(); i++) {
+        if (zones[i].name == name) {
+            return zones[i];
+        }
+    }
+    ProfileZone zone;
+    zone.name = name;
+    zone.depth = 0;
+    zone.cpu_start = 0;
+    zone.timing_gpu = false;
+    zone.cpu_ms = zone.gpu_ms = 0.f;
+    zone.cpu_total_ms = zone.gpu_total_ms = 0.0;
+    zone.cpu_max_ms = zone.gpu_max_ms = 0.f;
+    zone.cpu_samples = zone.gpu_samples = 0;
+    zone.gpu_skipped = 0;
+    for (int i = 0; i < PROFILER_QUERY_FRAMES; i++) {
+        zone.queries[i] = 0;
+        zone.issued[i] = false;
+    }
+    if (gpu_timing) {
+        glGenQueries(PROFILER_QUERY_FRAMES, zone.queries);
+    }
+    zones.push_back(zone);
+    return zones.back();
+}
+
+void Profiler::begin_frame() {
+    frame++;
+}
+
+void Profiler::begin_zone(const std::string& name) {
+    ProfileZone& zone = get_zone(name);
+    zone.depth = open_zones.size();
+    open_zones.push_back(&zone - &zones[0]);
+    zone.timing_gpu = gpu_timing && !gpu_query_active;
+    if (zone.timing_gpu && zone.issued[frame % PROFILER_QUERY_FRAMES]) {
+        //restarting it would throw away a result that's still coming
+        zone.timing_gpu = false;
+        zone.gpu_skipped++;
+    }
+    if (zone.timing_gpu) {
+        glBeginQuery(GL_TIME_ELAPSED, zone.queries[frame % PROFILER_QUERY_FRAMES]);
+        gpu_query_active = true;
+    }
+    zone.cpu_start = SDL_GetPerformanceCounter();
+}
+
+void Profiler::end_zone() {
+    if (open_zones.empty()) {
+        printf("Profiler zone ended without one open!\n");
+        return;
+    }
+    ProfileZone& zone = zones[open_zones.back()];
+    open_zones.pop_back();
+    zone.cpu_ms = (SDL_GetPerformanceCounter() - zone.cpu_start) * 1000.f / SDL_GetPerformanceFrequency();
+    zone.cpu_total_ms += zone.cpu_ms;
+    zone.cpu_max_ms = std::max(zone.cpu_max_ms, zone.cpu_ms);
+    zone.cpu_samples++;
+    if (zone.timing_gpu) {
+        glEndQuery(GL_TIME_ELAPSED);
+        zone.issued[frame % PROFILER_QUERY_FRAMES] = true;
+        gpu_query_active = false;
+    }
+}
+
+//collects the earlier frames' queries that have finished, oldest first. One that isn't ready stays issued and is
+//asked again next frame, the ones after it can't be ready either
+void Profiler::end_frame() {
+    if (!open_zones.empty()) {
+        printf("Profiler frame ended with %d zones open!\n", (int)open_zones.size());
+    }
+    for (size_t i = 0; i < zones.size(); i++) {
+        ProfileZone& zone = zones[i];
+        for (int age = PROFILER_QUERY_FRAMES - 1; age >= 1; age--) {
+            int slot = (frame + PROFILER_QUERY_FRAMES - age) % PROFILER_QUERY_FRAMES;
+            if (!zone.issued[slot]) {
+                continue;
+            }
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(zone.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available != GL_TRUE) {
+                break;
+            }
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(zone.queries[slot], GL_QUERY_RESULT, &elapsed);
+            zone.issued[slot] = false;
+            zone.gpu_ms = elapsed / 1000000.f;
+            zone.gpu_total_ms += zone.gpu_ms;
+            zone.gpu_max_ms = std::max(zone.gpu_max_ms, zone.gpu_ms);
+            zone.gpu_samples++;
+        }
+    }
+}
+
+void Profiler::render_overlay(Font& font, GLfloat x, GLfloat y) {
+    std::stringstream overlay;
+    overlay.setf(std::ios::fixed);
+    overlay.precision(2);
+    overlay << "zone cpu gpu ms";
+    for (size_t i = 0; i < zones.size(); i++) {
+        overlay << "\n" << std::string(zones[i].depth * 2, ' ') << zones[i].name << " " << zones[i].cpu_ms << " ";
+        if (zones[i].gpu_samples > 0) {
+            overlay << zones[i].gpu_ms;
+        } else {
+            overlay << "-";
+        }
+    }
+    font.render_text(x, y, overlay.str());
+}
+
+bool Profiler::dump(const std::string& path) {
+    std::ofstream out(path.c_str());
+    if (!out) {
+        printf("Unable to write profile %s!\n", path.c_str());
+        return false;
+    }
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "frames: " << frame << "\n";
+    out << "zone\tcpu avg ms\tcpu max ms\tgpu avg ms\tgpu max ms\tgpu frames skipped\n";
+    for (size_t i = 0; i < zones.size(); i++) {
+        const ProfileZone& zone = zones[i];
+        out << std::string(zone.depth * 2, ' ') << zone.name << "\t"
+            << (zone.cpu_samples > 0 ? zone.cpu_total_ms / zone.cpu_samples : 0.0) << "\t" << zone.cpu_max_ms << "\t";
+        if (zone.gpu_samples > 0) {
+            out << zone.gpu_total_ms / zone.gpu_samples << "\t" << zone.gpu_max_ms;
+        } else {
+            out << "-\t-";
+        }
+        out << "\t" << zone.gpu_skipped << "\n";
+    }
+    printf("Profile written to %s\n", path.c_str());
+    return true;
+}
+
+
+/* SHADERS */
 class ShaderProgram
 {
 public:
@@ -1084,15 +2746,27 @@ public:
     bool bind();
     void unbind();
     GLuint get_program_id();
+    GLint get_uniform_location(const std::string& name);
 
 protected:
+    GLuint load_shader_from_source(GLenum type, const GLchar* source);
+    bool link_program(const GLchar* vertex_source, const GLchar* fragment_source);
+    bool compile_and_link(const GLchar* vertex_source, const GLchar* fragment_source);
+    bool load_program_binary(const std::string& cache_path, Uint64 key, float& compile_ms);
+    void save_program_binary(const std::string& cache_path, Uint64 key, float compile_ms);
     void print_program_log( GLuint program );
     void print_shader_log( GLuint shader );
     GLuint program_id;
+    //glGetUniformLocation is a string lookup in the driver, each name is only asked for once
+    struct UniformLocation {
+        std::string name;
+        GLint location;
+    };
+    std::vector<UniformLocation> uniform_locations;
 };
 
 ShaderProgram::ShaderProgram() {
-    program_id = (GLuint) NULL;
+    program_id = 0;
 }
 
 ShaderProgram::~ShaderProgram() {
@@ -1100,12 +2774,20 @@ ShaderProgram::~ShaderProgram() {
 }
 
 void ShaderProgram::free_program() {
-    glDeleteProgram(program_id);
+    if (program_id != 0) {
+        //a program deleted while in use lives on until it's unbound, so only forget the binding
+        if (gl_state.program == program_id) {
+            gl_state.program = UNKNOWN_BINDING;
+        }
+        glDeleteProgram(program_id);
+        program_id = 0;
+    }
+    uniform_locations.clear();
 }
 
 bool ShaderProgram::bind() {
     bool success = true;
-    glUseProgram(program_id);
+    use_program(program_id);
     GLenum error = glGetError();
     if (error != GL_NO_ERROR) { 
         logGLError(std::cout, "Error binding shader!", error);
@@ -1115,14 +2797,193 @@ bool ShaderProgram::bind() {
     return success;
 }
 
+//back to the fixed function path, which draws from VAO 0
 void ShaderProgram::unbind() {
-    glUseProgram((GLuint)NULL);
+    use_program(0);
+    bind_vertex_array(0);
 }
 
 GLuint ShaderProgram::get_program_id() {
     return program_id;
 }
 
+GLint ShaderProgram::get_uniform_location(const std::string& name) {
+    for (size_t i = 0; i < uniform_locations.size(); i++) {
+        if (uniform_locations[i].name == name) {
+            return uniform_locations[i].location;
+        }
+    }
+    UniformLocation uniform = {name, glGetUniformLocation(program_id, name.c_str())};
+    if (uniform.location == -1) {
+        printf("%s is not a uniform in program %d!\n", name.c_str(), program_id);
+    }
+    uniform_locations.push_back(uniform);
+    return uniform.location;
+}
+
+//returns the compiled shader, or 0 after printing its log
+GLuint ShaderProgram::load_shader_from_source(GLenum type, const GLchar* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint compiled = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled != GL_TRUE) {
+        printf("Unable to compile shader %d!\n", shader);
+        print_shader_log(shader);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+/* PROGRAM BINARY CACHE */
+//linked programs are saved as driver binaries under this prefix, and loaded instead of compiled next time
+std::string SHADER_CACHE_PREFIX = "res/shader_";
+
+//baked program: this header, then the driver's binary
+struct ProgramBinaryHeader {
+    char magic[4];
+    Uint64 key;
+    GLenum binary_format;
+    GLint binary_length;
+    float compile_ms; //what compiling took when the binary was made, for the time saved log
+};
+
+const char PROGRAM_BINARY_MAGIC[4] = {'T', 'G', 'P', '1'};
+
+bool program_binaries_supported() {
+    if (!(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary)) {
+        return false;
+    }
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    return formats > 0;
+}
+
+//binaries only work on the driver that made them, so its identity is part of the key
+Uint64 program_cache_key(const GLchar* vertex_source, const GLchar* fragment_source) {
+    const GLenum DRIVER_STRINGS[3] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    Uint64 key = FNV_OFFSET_BASIS;
+    for (int i = 0; i < 3; i++) {
+        const char* driver = (const char*)glGetString(DRIVER_STRINGS[i]);
+        if (driver != nullptr) {
+            key = hash_bytes(driver, strlen(driver) + 1, key);
+        }
+    }
+    key = hash_bytes(vertex_source, strlen(vertex_source) + 1, key);
+    return hash_bytes(fragment_source, strlen(fragment_source) + 1, key);
+}
+
+bool ShaderProgram::link_program(const GLchar* vertex_source, const GLchar* fragment_source) {
+    free_program();
+    if (!program_binaries_supported()) {
+        return compile_and_link(vertex_source, fragment_source);
+    }
+    Uint64 key = program_cache_key(vertex_source, fragment_source);
+    std::stringstream cache_path;
+    cache_path << SHADER_CACHE_PREFIX << std::hex << key << ".cache";
+    Uint64 start = SDL_GetPerformanceCounter();
+    float compile_ms = 0.f;
+    if (load_program_binary(cache_path.str(), key, compile_ms)) {
+        float load_ms = (SDL_GetPerformanceCounter() - start) * 1000.f / SDL_GetPerformanceFrequency();
+        printf("Program %s loaded from binary in %.2f ms, saved %.2f ms of compiling\n", cache_path.str().c_str(),
+               load_ms, compile_ms - load_ms);
+        return true;
+    }
+    if (!compile_and_link(vertex_source, fragment_source)) {
+        return false;
+    }
+    compile_ms = (SDL_GetPerformanceCounter() - start) * 1000.f / SDL_GetPerformanceFrequency();
+    save_program_binary(cache_path.str(), key, compile_ms);
+    return true;
+}
+
+bool ShaderProgram::load_program_binary(const std::string& cache_path, Uint64 key, float& compile_ms) {
+    std::ifstream in(cache_path.c_str(), std::ifstream::in | std::ifstream::binary);
+    if (!in) {
+        return false;
+    }
+    ProgramBinaryHeader header;
+    if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, PROGRAM_BINARY_MAGIC, 4) != 0 ||
+        header.key != key || header.binary_length <= 0) {
+        return false;
+    }
+    std::vector<char> binary(header.binary_length);
+    if (!in.read(&binary[0], binary.size())) {
+        return false;
+    }
+    program_id = glCreateProgram();
+    glProgramBinary(program_id, header.binary_format, &binary[0], header.binary_length);
+    //the driver may refuse a binary it made before, after an update say
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program_id, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+        printf("Program binary %s was rejected, compiling instead\n", cache_path.c_str());
+        glDeleteProgram(program_id);
+        program_id = 0;
+        //a format the driver doesn't know raises GL_INVALID_ENUM, which would fail the next glGetError check
+        while (glGetError() != GL_NO_ERROR) {
+        }
+        return false;
+    }
+    compile_ms = header.compile_ms;
+    return true;
+}
+
+void ShaderProgram::save_program_binary(const std::string& cache_path, Uint64 key, float compile_ms) {
+    ProgramBinaryHeader header;
+    memcpy(header.magic, PROGRAM_BINARY_MAGIC, 4);
+    header.key = key;
+    header.compile_ms = compile_ms;
+    header.binary_length = 0;
+    glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &header.binary_length);
+    if (header.binary_length <= 0) {
+        return;
+    }
+    std::vector<char> binary(header.binary_length);
+    glGetProgramBinary(program_id, header.binary_length, NULL, &header.binary_format, &binary[0]);
+    std::ofstream out(cache_path.c_str(), std::ofstream::out | std::ofstream::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.write(&binary[0], binary.size());
+    if (!out) {
+        printf("Unable to write program binary %s!\n", cache_path.c_str());
+    }
+}
+
+bool ShaderProgram::compile_and_link(const GLchar* vertex_source, const GLchar* fragment_source) {
+    GLuint vertex_shader = load_shader_from_source(GL_VERTEX_SHADER, vertex_source);
+    if (vertex_shader == 0) {
+        return false;
+    }
+    GLuint fragment_shader = load_shader_from_source(GL_FRAGMENT_SHADER, fragment_source);
+    if (fragment_shader == 0) {
+        glDeleteShader(vertex_shader);
+        return false;
+    }
+    program_id = glCreateProgram();
+    glAttachShader(program_id, vertex_shader);
+    glAttachShader(program_id, fragment_shader);
+    if (program_binaries_supported()) {
+        glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program_id);
+    //the program keeps what it needs from the shaders once linked
+    glDetachShader(program_id, vertex_shader);
+    glDetachShader(program_id, fragment_shader);
+    glDeleteShader(vertex_shader);
+    glDeleteShader(fragment_shader);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program_id, GL_LINK_STATUS, &linked);
+    if (linked != GL_TRUE) {
+        printf("Error linking program %d!\n", program_id);
+        print_program_log(program_id);
+        free_program();
+        return false;
+    }
+    return true;
+}
+
 void ShaderProgram::print_program_log(GLuint program) {
     if(glIsProgram(program)) {
         int info_log_length = 0;
@@ -1145,7 +3006,7 @@ void ShaderProgram::print_shader_log(GLuint shader) {
         int max_length = info_log_length;
         glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &max_length);
         char* info_log = new char[max_length];
-        glGetShaderInfoLog(program_id, max_length, &info_log_length, info_log);
+        glGetShaderInfoLog(shader, max_length, &info_log_length, info_log);
         if (info_log_length > 0) {
             printf("%s\n", info_log);
         }
@@ -1155,37 +3016,670 @@ void ShaderProgram::print_shader_log(GLuint shader) {
     }  
 }
 
+//vertex attribute slots every 2D program uses, VertexData2D's layout
+const GLuint POSITION_ATTRIBUTE = 0;
+const GLuint TEXTURE_COORDINATE_ATTRIBUTE = 1;
+
+//flat colored polygons, transforms and color are uniforms instead of matrix stack and glColor state.
+//The setters skip the glUniform call when the value hasn't changed, the program must be bound
 class PlainPolygonProgram2D : public ShaderProgram {
 public:
+    PlainPolygonProgram2D();
     bool load_program();
-private:
+    void set_projection(const Matrix4& matrix);
+    void set_modelview(const Matrix4& matrix);
+    void set_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.f);
+protected:
+    bool link_2d_program(const GLchar* vertex_source, const GLchar* fragment_source);
+    GLint projection_location;
+    GLint modelview_location;
+    GLint color_location;
+    Matrix4 projection;
+    Matrix4 modelview;
+    GLfloat color[4];
 };
 
+PlainPolygonProgram2D::PlainPolygonProgram2D() {
+    projection_location = -1;
+    modelview_location = -1;
+    color_location = -1;
+}
+
 bool PlainPolygonProgram2D::load_program() {
-    GLint program_success = GL_TRUE;
-    program_id = glCreateProgram();
-    //Create vertex shader
-    GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-    //Get Vertex source
-    const GLchar* vertex_shader_source[] = {
-        "void main() { gl_Position = gl_Vertex; }"
-    };
-    //Set vertex source
-    glShaderSource(vertex_shader, 1, vertex_shader_source, NULL);
-    //compile vertex source
-    glCompileShader(vertex_shader);
-    //check for errors
-    GLint vs_compiled = GL_FALSE;
-    glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &vs_compiled);
-    if (vs_compiled != GL_TRUE) {
-        printf("Unable to compile vertex shader %d!\n", vertex_shader);
+    const GLchar* vertex_source =
+        "#version 330 core\n"
+        "layout(location = 0) in vec2 position;\n"
+        "uniform mat4 projection;\n"
+        "uniform mat4 modelview;\n"
+        "void main() { gl_Position = projection * modelview * vec4(position, 0.0, 1.0); }\n";
+    const GLchar* fragment_source =
+        "#version 330 core\n"
+        "uniform vec4 color;\n"
+        "out vec4 fragment_color;\n"
+        "void main() { fragment_color = color; }\n";
+    return link_2d_program(vertex_source, fragment_source);
+}
+
+//links, looks up the shared uniforms and loads their defaults
+bool PlainPolygonProgram2D::link_2d_program(const GLchar* vertex_source, const GLchar* fragment_source) {
+    if (!link_program(vertex_source, fragment_source)) {
         return false;
     }
-    //attach vertex shader to program
-    glAttachShader(program_id, vertex_shader);
+    projection_location = get_uniform_location("projection");
+    modelview_location = get_uniform_location("modelview");
+    color_location = get_uniform_location("color");
+    projection = identity_matrix();
+    modelview = identity_matrix();
+    color[0] = color[1] = color[2] = color[3] = 1.f;
+    use_program(program_id);
+    glUniformMatrix4fv(projection_location, 1, GL_FALSE, projection.m);
+    glUniformMatrix4fv(modelview_location, 1, GL_FALSE, modelview.m);
+    glUniform4fv(color_location, 1, color);
+    use_program(0);
+    return true;
+}
+
+void PlainPolygonProgram2D::set_projection(const Matrix4& matrix) {
+    if (memcmp(projection.m, matrix.m, sizeof(projection.m)) != 0) {
+        projection = matrix;
+        glUniformMatrix4fv(projection_location, 1, GL_FALSE, projection.m);
+    }
+}
+
+void PlainPolygonProgram2D::set_modelview(const Matrix4& matrix) {
+    if (memcmp(modelview.m, matrix.m, sizeof(modelview.m)) != 0) {
+        modelview = matrix;
+        glUniformMatrix4fv(modelview_location, 1, GL_FALSE, modelview.m);
+    }
+}
+
+void PlainPolygonProgram2D::set_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+    if (color[0] != r || color[1] != g || color[2] != b || color[3] != a) {
+        color[0] = r;
+        color[1] = g;
+        color[2] = b;
+        color[3] = a;
+        glUniform4fv(color_location, 1, color);
+    }
+}
+
+//textured polygons tinted by the color uniform, what the fixed function path does with GL_MODULATE
+class TexturedPolygonProgram2D : public PlainPolygonProgram2D {
+public:
+    bool load_program();
+};
+
+bool TexturedPolygonProgram2D::load_program() {
+    const GLchar* vertex_source =
+        "#version 330 core\n"
+        "layout(location = 0) in vec2 position;\n"
+        "layout(location = 1) in vec2 texture_coordinate;\n"
+        "uniform mat4 projection;\n"
+        "uniform mat4 modelview;\n"
+        "out vec2 uv;\n"
+        "void main() {\n"
+        "    uv = texture_coordinate;\n"
+        "    gl_Position = projection * modelview * vec4(position, 0.0, 1.0);\n"
+        "}\n";
+    const GLchar* fragment_source =
+        "#version 330 core\n"
+        "uniform vec4 color;\n"
+        "uniform sampler2D texture_unit;\n"
+        "in vec2 uv;\n"
+        "out vec4 fragment_color;\n"
+        "void main() { fragment_color = texture(texture_unit, uv) * color; }\n";
+    if (!link_2d_program(vertex_source, fragment_source)) {
+        return false;
+    }
+    use_program(program_id);
+    glUniform1i(get_uniform_location("texture_unit"), 0);
+    use_program(0);
+    return true;
+}
+
+//the sprite batch on the core profile path: one VAO holds the VertexData2D layout and a static index buffer
+//that turns every 4 vertices into two triangles, so a flush is a bind and one glDrawElements
+class ShaderSpriteBatch : public SpriteBatch {
+public:
+    ShaderSpriteBatch(TexturedPolygonProgram2D* custom_program = nullptr);
+    ~ShaderSpriteBatch();
+    bool init(GLuint max_sprites = 4096);
+    void free_batch();
+    void begin();
+    void end();
+    void set_projection(const Matrix4& matrix);
+    void set_modelview(const Matrix4& matrix);
+    void set_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a = 1.f);
+protected:
+    void flush();
+    TexturedPolygonProgram2D textured_program;
+    TexturedPolygonProgram2D* program; //textured_program, or one with the same uniforms and attributes
+    GLuint VAO_id;
+    GLuint IBO_id;
+    GLenum index_type;
+};
+
+ShaderSpriteBatch::ShaderSpriteBatch(TexturedPolygonProgram2D* custom_program) {
+    program = custom_program != nullptr ? custom_program : &textured_program;
+    VAO_id = 0;
+    IBO_id = 0;
+    index_type = GL_UNSIGNED_SHORT;
+}
+
+ShaderSpriteBatch::~ShaderSpriteBatch() {
+    free_batch();
+}
+
+bool ShaderSpriteBatch::init(GLuint max_sprites) {
+    free_batch();
+    if (!SpriteBatch::init(max_sprites) || !program->load_program()) {
+        return false;
+    }
+    //two triangles per quad, 16 bit indices while the vertices fit in them
+    GLuint index_count = capacity * 6;
+    const GLuint QUAD_INDICES[6] = {0, 1, 2, 2, 3, 0};
+    glGenBuffers(1, &IBO_id);
+    glGenVertexArrays(1, &VAO_id);
+    bind_vertex_array(VAO_id);
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, IBO_id);
+    if (capacity * 4 <= 65536) {
+        index_type = GL_UNSIGNED_SHORT;
+        std::vector<GLushort> indices(index_count);
+        for (GLuint i = 0; i < index_count; i++) {
+            indices[i] = (i / 6) * 4 + QUAD_INDICES[i % 6];
+        }
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
+    } else {
+        index_type = GL_UNSIGNED_INT;
+        std::vector<GLuint> indices(index_count);
+        for (GLuint i = 0; i < index_count; i++) {
+            indices[i] = (i / 6) * 4 + QUAD_INDICES[i % 6];
+        }
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+    }
+    bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+    glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+    glVertexAttribPointer(POSITION_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, position));
+    glEnableVertexAttribArray(TEXTURE_COORDINATE_ATTRIBUTE);
+    glVertexAttribPointer(TEXTURE_COORDINATE_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, texture_coordinate));
+    bind_vertex_array(0);
+    bind_buffer(GL_ARRAY_BUFFER, 0);
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    GLenum error = glGetError();
+    if (error != GL_NO_ERROR) {
+        logGLError(std::cout, "Error creating shader sprite batch!", error);
+        return false;
+    }
+    return true;
+}
 
-    //create fragment shader
-    
+void ShaderSpriteBatch::free_batch() {
+    if (VAO_id != 0) {
+        forget_vertex_array(VAO_id);
+        glDeleteVertexArrays(1, &VAO_id);
+        VAO_id = 0;
+    }
+    if (IBO_id != 0) {
+        forget_buffer(IBO_id);
+        glDeleteBuffers(1, &IBO_id);
+        IBO_id = 0;
+    }
+    program->free_program();
+    SpriteBatch::free_batch();
+}
+
+void ShaderSpriteBatch::begin() {
+    SpriteBatch::begin();
+    program->bind();
+}
+
+void ShaderSpriteBatch::end() {
+    flush();
+    program->unbind();
+}
+
+//uniform changes apply to everything after them, so what's queued is drawn first
+void ShaderSpriteBatch::set_projection(const Matrix4& matrix) {
+    flush();
+    program->set_projection(matrix);
+}
+
+void ShaderSpriteBatch::set_modelview(const Matrix4& matrix) {
+    flush();
+    program->set_modelview(matrix);
+}
+
+void ShaderSpriteBatch::set_color(GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+    flush();
+    program->set_color(r, g, b, a);
+}
+
+void ShaderSpriteBatch::flush() {
+    if (quad_count == 0) {
+        return;
+    }
+    bind_texture(batch_texture);
+    bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+    glBufferData(GL_ARRAY_BUFFER, capacity*4*sizeof(VertexData2D), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, quad_count*4*sizeof(VertexData2D), vertices);
+    bind_vertex_array(VAO_id);
+    glDrawElements(GL_TRIANGLES, quad_count*6, index_type, 0);
+    count_draw_call(quad_count*4);
+    //the fixed function paths draw from VAO 0
+    bind_vertex_array(0);
+    quad_count = 0;
+}
+
+/* SHADER PATH DRAWS */
+//single textures, sprites and text through a TexturedPolygonProgram2D instead of the matrix stack, client arrays
+//and GL_QUADS. The program's projection, modelview and color apply, positions are placed like the batches place them.
+//The format VAO stays bound between draws, unbinding the program goes back to VAO 0
+
+//every 4 vertices as two triangles, for drawing quad lists without GL_QUADS. Grows to the longest list drawn
+GLuint quad_index_buffer = 0;
+GLuint quad_index_capacity = 0;
+
+//binds the VertexData2D VAO with its attributes reading from buffer
+void bind_vertex_format_2d(GLuint buffer) {
+    if (vertex_format_2d.VAO_id == 0) {
+        glGenVertexArrays(1, &vertex_format_2d.VAO_id);
+        bind_vertex_array(vertex_format_2d.VAO_id);
+        glEnableVertexAttribArray(POSITION_ATTRIBUTE);
+        glEnableVertexAttribArray(TEXTURE_COORDINATE_ATTRIBUTE);
+    }
+    bind_vertex_array(vertex_format_2d.VAO_id);
+    if (state_changed(vertex_format_2d.attribute_buffer, buffer)) {
+        bind_buffer(GL_ARRAY_BUFFER, buffer);
+        glVertexAttribPointer(POSITION_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, position));
+        glVertexAttribPointer(TEXTURE_COORDINATE_ATTRIBUTE, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData2D), (GLvoid*)offsetof(VertexData2D, texture_coordinate));
+    }
+}
+
+//the VAO must be bound, the index buffer is part of it
+void bind_quad_indices(GLuint quad_count) {
+    if (quad_count > quad_index_capacity) {
+        if (quad_index_buffer == 0) {
+            glGenBuffers(1, &quad_index_buffer);
+        }
+        quad_index_capacity = std::max(quad_count, std::max(quad_index_capacity * 2, (GLuint)64));
+        const GLuint QUAD_INDICES[6] = {0, 1, 2, 2, 3, 0};
+        std::vector<GLuint> indices(quad_index_capacity * 6);
+        for (GLuint i = 0; i < indices.size(); i++) {
+            indices[i] = (i / 6) * 4 + QUAD_INDICES[i % 6];
+        }
+        bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+    }
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, quad_index_buffer);
+}
+
+void free_vertex_formats() {
+    if (vertex_format_2d.VAO_id != 0) {
+        forget_vertex_array(vertex_format_2d.VAO_id);
+        glDeleteVertexArrays(1, &vertex_format_2d.VAO_id);
+        vertex_format_2d.VAO_id = 0;
+        vertex_format_2d.attribute_buffer = 0;
+    }
+    if (quad_index_buffer != 0) {
+        forget_buffer(quad_index_buffer);
+        glDeleteBuffers(1, &quad_index_buffer);
+        quad_index_buffer = 0;
+        quad_index_capacity = 0;
+    }
+}
+
+void Texture::render(TexturedPolygonProgram2D& program, GLfloat x, GLfloat y, FRect* clip) {
+    if (texture_id != 0) {
+        VertexData2D vertex_data[4];
+        make_quad(x, y, clip, vertex_data);
+        use_program(program.get_program_id());
+        bind_texture(texture_id);
+        bind_buffer(GL_ARRAY_BUFFER, VBO_id);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, 4*sizeof(VertexData2D), vertex_data);
+        bind_vertex_format_2d(VBO_id);
+        //the 0 1 2 3 indices fan into the quad's two triangles
+        bind_buffer(GL_ELEMENT_ARRAY_BUFFER, IBO_id);
+        glDrawElements(GL_TRIANGLE_FAN, 4, GL_UNSIGNED_INT, NULL);
+        count_draw_call(4);
+    }
+}
+
+void SpriteSheet::render_sprite(TexturedPolygonProgram2D& program, int index) {
+    if (vertex_data_buffer != (GLuint)NULL) {
+        use_program(program.get_program_id());
+        bind_texture(get_texture_id());
+        bind_vertex_format_2d(vertex_data_buffer);
+        bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffers[index]);
+        glDrawElements(GL_TRIANGLE_FAN, 4, GL_UNSIGNED_INT, NULL);
+        count_draw_call(4);
+    }
+}
+
+void Font::render_text(TexturedPolygonProgram2D& program, GLfloat x, GLfloat y, std::string text) {
+    if (get_texture_id() != 0) {
+        TextMesh& mesh = get_text_mesh(x, y, text);
+        if (mesh.vertex_count == 0) {
+            return;
+        }
+        use_program(program.get_program_id());
+        bind_texture(get_texture_id());
+        bind_vertex_format_2d(mesh.VBO_id);
+        bind_quad_indices(mesh.vertex_count / 4);
+        glDrawElements(GL_TRIANGLES, mesh.vertex_count / 4 * 6, GL_UNSIGNED_INT, NULL);
+        count_draw_call(mesh.vertex_count);
+    }
+}
+
+/* SDF FONTS */
+//signed distance field text: each glyph is stored once as distance to its outline, and the shader turns that
+//back into a crisp edge at whatever size the text is drawn
+class SDFTextProgram2D : public TexturedPolygonProgram2D {
+public:
+    bool load_program();
+};
+
+bool SDFTextProgram2D::load_program() {
+    const GLchar* vertex_source =
+        "#version 330 core\n"
+        "layout(location = 0) in vec2 position;\n"
+        "layout(location = 1) in vec2 texture_coordinate;\n"
+        "uniform mat4 projection;\n"
+        "uniform mat4 modelview;\n"
+        "out vec2 uv;\n"
+        "void main() {\n"
+        "    uv = texture_coordinate;\n"
+        "    gl_Position = projection * modelview * vec4(position, 0.0, 1.0);\n"
+        "}\n";
+    //the outline is at .5, fwidth keeps the antialiased edge about a screen pixel wide at any scale
+    const GLchar* fragment_source =
+        "#version 330 core\n"
+        "uniform vec4 color;\n"
+        "uniform sampler2D texture_unit;\n"
+        "in vec2 uv;\n"
+        "out vec4 fragment_color;\n"
+        "void main() {\n"
+        "    float distance = texture(texture_unit, uv).r;\n"
+        "    float width = fwidth(distance) * 0.5;\n"
+        "    fragment_color = vec4(color.rgb, color.a * smoothstep(0.5 - width, 0.5 + width, distance));\n"
+        "}\n";
+    if (!link_2d_program(vertex_source, fragment_source)) {
+        return false;
+    }
+    use_program(program_id);
+    glUniform1i(get_uniform_location("texture_unit"), 0);
+    use_program(0);
+    return true;
+}
+
+//a glyph in the atlas, in pixels of the size the font was rasterized at
+struct SDFGlyph {
+    FRect clip;
+    GLfloat x_offset; //from the pen to the clip's top left, the pen is at the top of the line
+    GLfloat y_offset;
+    GLfloat advance;
+};
+
+const int SDF_FIRST_CHAR = 32;
+const int SDF_CHAR_COUNT = 95;
+const int SDF_SPREAD = 6; //distance stored either side of an outline, in raster pixels
+const GLuint SDF_ATLAS_WIDTH = 512;
+const GLuint SDF_MAX_ATLAS_HEIGHT = 4096;
+
+//baked atlas: this header, the glyphs, then the distance texels
+struct SDFCacheHeader {
+    char magic[4];
+    Uint64 font_hash;
+    int raster_size;
+    int spread;
+    GLuint atlas_width;
+    GLuint atlas_height;
+    GLfloat line_height;
+};
+
+const char SDF_CACHE_MAGIC[4] = {'T', 'G', 'S', '1'};
+
+class SDFFont {
+public:
+    SDFFont();
+    ~SDFFont();
+    bool load_font(std::string path, int raster_size = 48);
+    void free_font();
+    void set_projection(const Matrix4& matrix);
+    void render_text(GLfloat x, GLfloat y, std::string text, GLfloat size, GLfloat r = 1.f, GLfloat g = 1.f, GLfloat b = 1.f, GLfloat a = 1.f);
+    GLfloat get_line_height(GLfloat size);
+private:
+    bool generate_atlas(const std::string& path, std::vector<GLubyte>& pixels, GLuint& atlas_height);
+    bool load_cache(const std::string& cache_path, Uint64 font_hash, std::vector<GLubyte>& pixels, GLuint& atlas_height);
+    void save_cache(const std::string& cache_path, Uint64 font_hash, const std::vector<GLubyte>& pixels, GLuint atlas_height);
+    SDFTextProgram2D program;
+    ShaderSpriteBatch batch;
+    Texture atlas;
+    SDFGlyph glyphs[SDF_CHAR_COUNT];
+    int raster_size;
+    GLfloat line_height;
+};
+
+SDFFont::SDFFont() : batch(&program) {
+    raster_size = 0;
+    line_height = 0.f;
+}
+
+SDFFont::~SDFFont() {
+    free_font();
+}
+
+void SDFFont::free_font() {
+    batch.free_batch();
+    atlas.free_texture();
+    raster_size = 0;
+    line_height = 0.f;
+}
+
+bool SDFFont::load_font(std::string path, int size) {
+    free_font();
+    raster_size = size;
+    //the atlas only depends on the font file and the raster size, so it's generated once and baked next to the font
+    std::stringstream cache_path;
+    cache_path << path << "." << raster_size << ".sdf.cache";
+    Uint64 font_hash = 0;
+    bool hashed = hash_file(path, font_hash);
+    std::vector<GLubyte> pixels;
+    GLuint atlas_height = 0;
+    if (!hashed || !load_cache(cache_path.str(), font_hash, pixels, atlas_height)) {
+        if (!generate_atlas(path, pixels, atlas_height)) {
+            printf("Unable to generate SDF atlas for %s!\n", path.c_str());
+            return false;
+        }
+        if (hashed) {
+            save_cache(cache_path.str(), font_hash, pixels, atlas_height);
+        }
+    }
+    if (!atlas.load_texture_from_red_pixels(&pixels[0], SDF_ATLAS_WIDTH, atlas_height)) {
+        printf("Unable to create SDF atlas texture!\n");
+        return false;
+    }
+    if (!batch.init(1024)) {
+        printf("Unable to create SDF text batch!\n");
+        return false;
+    }
+    return true;
+}
+
+bool SDFFont::generate_atlas(const std::string& path, std::vector<GLubyte>& pixels, GLuint& atlas_height) {
+    TTF_Font* ttf = TTF_OpenFont(path.c_str(), raster_size);
+    if (ttf == nullptr) {
+        logSDLError(std::cout, "TTF_OpenFont");
+        return false;
+    }
+    line_height = TTF_FontLineSkip(ttf);
+    pixels.assign(SDF_ATLAS_WIDTH * SDF_MAX_ATLAS_HEIGHT, 0);
+    SkylinePacker packer;
+    packer.init(SDF_ATLAS_WIDTH, SDF_MAX_ATLAS_HEIGHT);
+    const SDL_Color WHITE_GLYPH = {255, 255, 255, 255};
+    std::vector<char> ink;
+    bool success = true;
+    for (int c = 0; c < SDF_CHAR_COUNT && success; c++) {
+        SDFGlyph& glyph = glyphs[c];
+        FRect empty = {0.f, 0.f, 0.f, 0.f};
+        glyph.clip = empty;
+        glyph.x_offset = glyph.y_offset = 0.f;
+        glyph.advance = 0.f;
+        int min_x, max_x, min_y, max_y, advance;
+        if (TTF_GlyphMetrics(ttf, SDF_FIRST_CHAR + c, &min_x, &max_x, &min_y, &max_y, &advance) != 0) {
+            continue;
+        }
+        glyph.advance = advance;
+        SDL_Surface* rendered = TTF_RenderGlyph_Blended(ttf, SDF_FIRST_CHAR + c, WHITE_GLYPH);
+        if (rendered == nullptr) {
+            continue;
+        }
+        SDL_Surface* surface = SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_RGBA32, 0);
+        SDL_FreeSurface(rendered);
+        if (surface == nullptr) {
+            logSDLError(std::cout, "SDL_ConvertSurfaceFormat");
+            success = false;
+            break;
+        }
+        //inside is wherever coverage is over half, the distances are measured from that outline
+        int w = surface->w;
+        int h = surface->h;
+        ink.assign(w * h, 0);
+        int left = w, right = -1, top = h, bottom = -1;
+        for (int y = 0; y < h; y++) {
+            GLubyte* row = (GLubyte*)surface->pixels + y * surface->pitch;
+            for (int x = 0; x < w; x++) {
+                if (row[x*4 + 3] >= 128) {
+                    ink[y*w + x] = 1;
+                    left = std::min(left, x);
+                    right = std::max(right, x);
+                    top = std::min(top, y);
+                    bottom = std::max(bottom, y);
+                }
+            }
+        }
+        SDL_FreeSurface(surface);
+        if (right < 0) {
+            continue; //nothing to draw, like space
+        }
+        //the field reaches SDF_SPREAD past the ink on every side, plus a texel of gap to the next glyph
+        int field_w = right - left + 1 + 2*SDF_SPREAD;
+        int field_h = bottom - top + 1 + 2*SDF_SPREAD;
+        GLuint atlas_x, atlas_y;
+        if (!packer.insert(field_w + 1, field_h + 1, atlas_x, atlas_y)) {
+            printf("SDF atlas is full!\n");
+            success = false;
+            break;
+        }
+        for (int fy = 0; fy < field_h; fy++) {
+            for (int fx = 0; fx < field_w; fx++) {
+                int sx = left - SDF_SPREAD + fx;
+                int sy = top - SDF_SPREAD + fy;
+                bool inside = sx >= 0 && sx < w && sy >= 0 && sy < h && ink[sy*w + sx];
+                //nearest texel on the other side of the outline, within the spread
+                int nearest = (SDF_SPREAD + 1) * (SDF_SPREAD + 1);
+                for (int dy = -SDF_SPREAD; dy <= SDF_SPREAD; dy++) {
+                    for (int dx = -SDF_SPREAD; dx <= SDF_SPREAD; dx++) {
+                        int nx = sx + dx;
+                        int ny = sy + dy;
+                        bool other = nx >= 0 && nx < w && ny >= 0 && ny < h && ink[ny*w + nx];
+                        if (other != inside && dx*dx + dy*dy < nearest) {
+                            nearest = dx*dx + dy*dy;
+                        }
+                    }
+                }
+                //the outline sits half way between the two texel centers
+                GLfloat distance = std::sqrt((GLfloat)nearest) - 0.5f;
+                GLfloat value = 128.f + (inside ? distance : -distance) * 127.f / SDF_SPREAD;
+                pixels[(atlas_y + fy) * SDF_ATLAS_WIDTH + atlas_x + fx] = (GLubyte)std::min(std::max(value, 0.f), 255.f);
+            }
+        }
+        glyph.clip.x = atlas_x;
+        glyph.clip.y = atlas_y;
+        glyph.clip.w = field_w;
+        glyph.clip.h = field_h;
+        glyph.x_offset = left - SDF_SPREAD;
+        glyph.y_offset = top - SDF_SPREAD;
+    }
+    TTF_CloseFont(ttf);
+    atlas_height = Texture::storage_size(packer.get_used_height());
+    pixels.resize(SDF_ATLAS_WIDTH * atlas_height);
+    return success;
+}
+
+bool SDFFont::load_cache(const std::string& cache_path, Uint64 font_hash, std::vector<GLubyte>& pixels, GLuint& atlas_height) {
+    std::ifstream in(cache_path.c_str(), std::ifstream::in | std::ifstream::binary);
+    if (!in) {
+        return false;
+    }
+    SDFCacheHeader header;
+    if (!in.read((char*)&header, sizeof(header)) || memcmp(header.magic, SDF_CACHE_MAGIC, 4) != 0 ||
+        header.font_hash != font_hash || header.raster_size != raster_size || header.spread != SDF_SPREAD ||
+        header.atlas_width != SDF_ATLAS_WIDTH || header.atlas_height == 0 || header.atlas_height > SDF_MAX_ATLAS_HEIGHT) {
+        return false;
+    }
+    //the glyphs are only kept once the whole file has been read
+    SDFGlyph cached_glyphs[SDF_CHAR_COUNT];
+    pixels.resize(header.atlas_width * header.atlas_height);
+    if (!in.read((char*)cached_glyphs, sizeof(cached_glyphs)) || !in.read((char*)&pixels[0], pixels.size())) {
+        return false;
+    }
+    memcpy(glyphs, cached_glyphs, sizeof(glyphs));
+    atlas_height = header.atlas_height;
+    line_height = header.line_height;
+    return true;
+}
+
+void SDFFont::save_cache(const std::string& cache_path, Uint64 font_hash, const std::vector<GLubyte>& pixels, GLuint atlas_height) {
+    SDFCacheHeader header;
+    memcpy(header.magic, SDF_CACHE_MAGIC, 4);
+    header.font_hash = font_hash;
+    header.raster_size = raster_size;
+    header.spread = SDF_SPREAD;
+    header.atlas_width = SDF_ATLAS_WIDTH;
+    header.atlas_height = atlas_height;
+    header.line_height = line_height;
+    std::ofstream out(cache_path.c_str(), std::ofstream::out | std::ofstream::binary);
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)glyphs, sizeof(glyphs));
+    out.write((const char*)&pixels[0], pixels.size());
+    if (!out) {
+        printf("Unable to write SDF cache %s!\n", cache_path.c_str());
+    }
+}
+
+void SDFFont::set_projection(const Matrix4& matrix) {
+    batch.begin();
+    batch.set_projection(matrix);
+    batch.end();
+}
+
+GLfloat SDFFont::get_line_height(GLfloat size) {
+    return raster_size > 0 ? line_height * size / raster_size : 0.f;
+}
 
-    return program_success;
-}
\ No newline at end of file
+//size is the pixel height to draw at, the scale is a uniform so every size draws from the same atlas
+void SDFFont::render_text(GLfloat x, GLfloat y, std::string text, GLfloat size, GLfloat r, GLfloat g, GLfloat b, GLfloat a) {
+    if (atlas.get_texture_id() == 0) {
+        return;
+    }
+    GLfloat scale = size / raster_size;
+    batch.begin();
+    batch.set_modelview(translation_matrix(x, y, 0.f) * scale_matrix(scale, scale, 1.f));
+    batch.set_color(r, g, b, a);
+    GLfloat pen_x = 0.f;
+    GLfloat pen_y = 0.f;
+    for (size_t i = 0; i < text.length(); i++) {
+        int c = (unsigned char)text[i] - SDF_FIRST_CHAR;
+        if (text[i] == '\n') {
+            pen_x = 0.f;
+            pen_y += line_height;
+        } else if (c >= 0 && c < SDF_CHAR_COUNT) {
+            SDFGlyph& glyph = glyphs[c];
+            if (glyph.clip.w > 0.f) {
+                batch.draw_texture(atlas, pen_x + glyph.x_offset, pen_y + glyph.y_offset, &glyph.clip);
+            }
+            pen_x += glyph.advance;
+        }
+    }
+    batch.end();
+}